@@ -7,13 +7,32 @@
 #include <linux/init.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
-
-// TODO - this has been designed with multiple parallel ports in mind, which will probably
-// never happen.  If it does however, the timer is shared and needs to be changed so that
-// it is suspended when ever the list of lintap devices is modified.  Otherwise, it could
-// interrupt when the list is being altered and cause some nasty error.
-
-// TODO - replace timer active flag with kernel function to check for pending timer event
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/rcupdate.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/device.h>
+#include <linux/io.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/spinlock.h>
+
+#include "lintap.h"
+#include "lintap_psx.h"
 
 /* Module Information */
 
@@ -23,33 +42,44 @@ MODULE_LICENSE("GPL");
 
 /* Constants Definitions */
 
-#define LINTAP_VERSION 15032015
+#define PC_DATA_REGISTER        0			//offsets of registers from the base address of a PC style port
+#define PC_STATUS_REGISTER      1
+
+#define PSX_DELAY_MAX				1000		//longest delay that can be set for a port (usecs)
+
+#define CALIBRATE_ROUNDS		100			//default number of transactions each calibration step must pass
+#define CALIBRATE_MARGIN		50			//default safety margin added to calibrated delays (percent)
+#define CALIBRATE_STEP_NS		100			//resolution of the calibrated phase timings (nsecs)
 
-#define PSX_COMMAND             0x01		//00000001b	//bit 0 of data register
-#define PSX_SELECT_ALL          0x02		//00000010b	//bit 2 of data register
-#define PSX_CLOCK               0x04		//00000100b	//bit 2 of data register
+#define IO_MEASURE_ACCESSES		32			//port accesses timed in each run when measuring their cost
+#define IO_MEASURE_RUNS			4			//the quickest run is taken, as an interrupt can stretch any of them
 
-#define PSX_DATA_0              0x08		//00001000b	//bit 3 of status register
-#define PSX_DATA_1              0x10		//00010000b	//bit 4 of status register
-#define PSX_DATA_2              0x20		//00100000b	//bit 5 of status register
-#define PSX_DATA_3              0x40		//01000000b	//bit 6 of status register
+#define PSX_AGGREGATE_ID		8			//product ID of the single input device of a port in aggregate mode
+#define PSX_SCRATCH_ID			9			//product ID of the scratch input devices of the benchmark and replay
+#define AGGREGATE_BUTTONS		10			//buttons of each pad from BTN_TRIGGER_HAPPY1 on in aggregate mode, L3 and R3 go from BTN_0 on
 
-#define PSX_ACKNOWLEDGE			0x80		//10000000b	//bit 7 of status register
+#define POLL_HZ					100			//default number of polls per second
+#define POLL_HZ_MIN				10
+#define POLL_HZ_MAX				1000
+#define POLL_HZ_IDLE			20			//default poll rate of idle ports in adaptive mode
+#define IDLE_TIMEOUT			5000		//default msecs without input before a port is idle in adaptive mode
 
-#define PSX_COMMAND_START		0x01		//init start state command
-#define PSX_COMMAND_TRANSFER	0x42		//request pad status command
-#define PSX_NORMAL_PAD_ID		0x41		//what pad should return in response to start command
-#define PSX_NORMAL_STATUS		0x5a		//what pad should return in response to status request
+#define PROBE_INTERVAL			1000		//default msecs between checks for pads being connected or disconnected
+#define PROBE_INTERVAL_MIN		10
+#define PAD_MISSED_PROBES		2			//consecutive probes a pad must be missing for before it is unregistered
 
-#define PSX_BIT_DELAY				5			//number of useconds
-#define PSX_CMD_DELAY				10
+#define TRANSFER_PATH_GENERIC	0			//transactions go through the parport operations of the port
+#define TRANSFER_PATH_DIRECT	1			//transactions access the registers of a PC style port directly
+#define TRANSFER_PATHS			2
 
-#define MAX_PADS				4			//maximum number of pads that can be connected
-#define MAX_BUTTONS				10			//number of buttons on pad
+#define STATS_HISTOGRAM_BUCKETS	32			//log2 histogram buckets, the last one also counts anything longer than 2^31 nsecs
 
-#define PSX_PAD_ID				7
+#define BENCH_ROUNDS			1000		//rounds of each benchmark in debugfs
+#define CAPTURE_RECORDS			4096		//transactions kept by the capture of each port, also the most that can be replayed.  A power of 2
 
-#define GC_REFRESH_TIME	HZ/100
+#define POLL_STATS_SHIFT		4			//measured period and jitter are averaged over roughly 2^4 polls
+
+#define POLL_THREAD_PRIORITY	50			//default SCHED_FIFO priority of the polling thread
 
 /* End Constants */
 
@@ -64,37 +94,237 @@ MODULE_LICENSE("GPL");
 
 static unsigned short bit_delay = PSX_BIT_DELAY;
 static unsigned short cmd_delay = PSX_CMD_DELAY;
-// Set up two parameters which are world readable in sysfs
+// Set up two parameters which are world readable in sysfs.  These are the starting delays
+// for each port, which can then be changed or calibrated per port through sysfs
 module_param(bit_delay, ushort, 0444);
-MODULE_PARM_DESC(bit_delay, "Delay between bits when receiving reading pad status (usecs).  Default 5");
+MODULE_PARM_DESC(bit_delay, "Initial select setup, clock low and clock high time of each port (usecs).  Default 5");
 module_param(cmd_delay, ushort, 0444);
-MODULE_PARM_DESC(cmd_delay, "Delay after sending command to PSX pad (usecs).  Default 10");
+MODULE_PARM_DESC(cmd_delay, "Initial extra gap after each byte of each port (usecs).  Default 10");
+
+static bool calibrate = false;
+static unsigned int calibrate_rounds = CALIBRATE_ROUNDS;
+static unsigned int calibrate_margin = CALIBRATE_MARGIN;
+
+// Calibration passes delays which no transaction failed with, so it needs at least one round
+static int set_calibrate_rounds(const char* val, const struct kernel_param* kp)
+{
+    unsigned int rounds;
+    int ret = kstrtouint(val, 10, &rounds);
+
+    if (ret != 0) { return ret; }
+    if (rounds == 0) { return -EINVAL; }
+    *((unsigned int*)kp->arg) = rounds;
+    return 0;
+}
+
+static const struct kernel_param_ops calibrate_rounds_ops = {
+    .set = set_calibrate_rounds,
+    .get = param_get_uint,
+};
+
+module_param(calibrate, bool, 0444);
+MODULE_PARM_DESC(calibrate, "Calibrate the delays of each port when pads are first found on it.  Default 0");
+module_param_cb(calibrate_rounds, &calibrate_rounds_ops, &calibrate_rounds, 0644);
+MODULE_PARM_DESC(calibrate_rounds, "Number of transactions which must all succeed for delays to pass calibration (at least 1).  Default 100");
+module_param(calibrate_margin, uint, 0644);
+MODULE_PARM_DESC(calibrate_margin, "Safety margin added to the smallest working delays found by calibration (percent).  Default 50");
+
+static unsigned int poll_hz = POLL_HZ;
+
+// Only accept poll rates within the supported range.  Takes effect from the next poll
+static int set_poll_hz(const char* val, const struct kernel_param* kp)
+{
+    unsigned int hz;
+    int ret = kstrtouint(val, 10, &hz);
+
+    if (ret != 0) { return ret; }
+    if (hz < POLL_HZ_MIN || hz > POLL_HZ_MAX) { return -EINVAL; }
+    *((unsigned int*)kp->arg) = hz;
+    return 0;
+}
+
+static const struct kernel_param_ops poll_hz_ops = {
+    .set = set_poll_hz,
+    .get = param_get_uint,
+};
+
+module_param_cb(poll_hz, &poll_hz_ops, &poll_hz, 0644);
+MODULE_PARM_DESC(poll_hz, "Number of times per second the pads are polled (10-1000).  Default 100");
+
+static bool adaptive_poll = false;
+static unsigned int poll_hz_idle = POLL_HZ_IDLE;
+static unsigned int idle_timeout = IDLE_TIMEOUT;
+module_param(adaptive_poll, bool, 0644);
+MODULE_PARM_DESC(adaptive_poll, "Poll ports at poll_hz_idle once their pads have had no input for idle_timeout.  Default 0");
+module_param_cb(poll_hz_idle, &poll_hz_ops, &poll_hz_idle, 0644);
+MODULE_PARM_DESC(poll_hz_idle, "Number of times per second idle ports are polled in adaptive mode (10-1000).  Default 20");
+module_param(idle_timeout, uint, 0644);
+MODULE_PARM_DESC(idle_timeout, "Time without input before a port is idle in adaptive mode (msecs).  Default 5000");
+
+static unsigned int probe_interval = PROBE_INTERVAL;
+
+// Only accept probe intervals which won't keep the port busy
+static int set_probe_interval(const char* val, const struct kernel_param* kp)
+{
+    unsigned int interval;
+    int ret = kstrtouint(val, 10, &interval);
+
+    if (ret != 0) { return ret; }
+    if (interval < PROBE_INTERVAL_MIN) { return -EINVAL; }
+    *((unsigned int*)kp->arg) = interval;
+    return 0;
+}
+
+static const struct kernel_param_ops probe_interval_ops = {
+    .set = set_probe_interval,
+    .get = param_get_uint,
+};
+
+module_param_cb(probe_interval, &probe_interval_ops, &probe_interval, 0644);
+MODULE_PARM_DESC(probe_interval, "Time between checks for pads being connected or disconnected (msecs).  Default 1000");
+
+static bool ack_handshake = false;
+static unsigned short ack_timeout = PSX_ACK_TIMEOUT;
+module_param(ack_handshake, bool, 0644);
+MODULE_PARM_DESC(ack_handshake, "Wait for pads to acknowledge each byte instead of a fixed byte gap.  Default 0");
+module_param(ack_timeout, ushort, 0644);
+MODULE_PARM_DESC(ack_timeout, "Longest wait for pads to acknowledge a byte before they are treated as missing (usecs).  Default 100");
+
+static bool direct_io = true;
+module_param(direct_io, bool, 0444);
+MODULE_PARM_DESC(direct_io, "Access the registers of PC style ports directly instead of through parport operations.  Default 1");
+
+static bool timer_engine = false;
+module_param(timer_engine, bool, 0444);
+MODULE_PARM_DESC(timer_engine, "Clock polls with a high resolution timer event for each edge instead of busy waiting.  Default 0");
+
+static bool aggregate = false;
+module_param(aggregate, bool, 0444);
+MODULE_PARM_DESC(aggregate, "Give each port one input device for all its pads instead of one per pad.  Default 0");
+
+static bool capture = false;
+module_param(capture, bool, 0444);
+MODULE_PARM_DESC(capture, "Record the raw samples and decoded pads of the last 4096 transactions on each port, for debugfs.  Default 0");
+
+static bool poll_thread = false;
+static int poll_cpu[PARPORT_MAX] = { [0 ... PARPORT_MAX - 1] = -1 };
+static int poll_cpu_count = 0;
+static int poll_priority = POLL_THREAD_PRIORITY;
+// Polling thread parameters.  Only read when polling starts, so they are not writable at runtime.
+// Each port has its own polling thread, bound to the CPU given for its port number
+module_param(poll_thread, bool, 0444);
+MODULE_PARM_DESC(poll_thread, "Poll the pads on each port from a dedicated kernel thread instead of the timer softirq.  Default 0");
+module_param_array(poll_cpu, int, &poll_cpu_count, 0444);
+MODULE_PARM_DESC(poll_cpu, "CPU the polling thread of each port is bound to, in port number order, -1 for any CPU.  Default -1");
+module_param(poll_priority, int, 0444);
+MODULE_PARM_DESC(poll_priority, "SCHED_FIFO priority of the polling thread (1-99), 0 for normal scheduling.  Default 50");
 
 /* User defined types */
-typedef enum PSX_Status_Mask {PSX_LEFT = 0x0080, PSX_DOWN = 0x0040, PSX_RIGHT = 0x0020,
-	PSX_UP = 0x0010, PSX_START = 0x0008, PSX_SELECT = 0x0001, PSX_SQUARE = 0x8000, PSX_CROSS = 0x4000,
-	PSX_CIRCLE = 0x2000, PSX_TRIANGLE = 0x1000, PSX_RIGHT1 = 0x0800, PSX_LEFT1 = 0x0400,
-	PSX_RIGHT2 = 0x0200, PSX_LEFT2 = 0x0100} psx_status_mask;
+// Steps of a transaction clocked by the timer engine, each done by one timer event
+enum lintap_engine_state { ENGINE_ATTENTION, ENGINE_CLOCK_LOW, ENGINE_CLOCK_HIGH, ENGINE_DESELECT };
+// Phases of a transaction with their own timing.  Select setup is the time from raising select to
+// lowering it, and from lowering it to the first clock edge.  Clock low and clock high are the time
+// from each clock edge to the next, and the byte gap is extra time after the last bit of each byte
+enum lintap_phase { PHASE_SELECT_SETUP, PHASE_CLOCK_LOW, PHASE_CLOCK_HIGH, PHASE_BYTE_GAP, PHASES };
 /* End types */
 
 /* Data Structures */
 
+// Performance statistics for a port, shown in debugfs.  Only updated by whatever is doing the
+// transaction on the port, which is never more than one thing at a time, so plain counters are
+// cheap enough to keep all the time.  Times are in nsecs, histogram bucket n counts times from
+// 2^(n-1) up to 2^n
+struct lintap_stats {
+	u64 polls;								//number of polls of the port
+	u64 transfers;							//number of transactions, including probing and calibration
+	u64 transfer_ns_total;					//time spent in psxpads_read_status
+	u64 transfer_ns_max;
+	u64 lateness_ns_total;					//time between a poll being due and it starting
+	u64 lateness_ns_max;
+	u64 pad_errors[MAX_PADS];				//polls where a connected pad didn't give a valid ID and status
+	u32 transfer_histogram[STATS_HISTOGRAM_BUCKETS];	//transaction durations
+	u32 interval_histogram[STATS_HISTOGRAM_BUCKETS];	//time between polls
+	ktime_t last_poll;						//time the last poll started, zero if the port hasn't been polled
+};
+
+// A transaction clocked by the timer engine.  Only one runs at a time on a port, owned by whoever
+// set the busy bit, and the engine timer moves it on one clock edge per event
+struct lintap_engine {
+	struct hrtimer timer;					//fires for each edge of the transaction
+	unsigned long busy;						//bit 0 set while a transaction is running
+	enum lintap_engine_state state;			//step for the next timer event
+	bool direct;							//TRUE if the transaction uses the direct transfer path
+	int byte_count;							//byte of the transaction being clocked
+	int bit_count;							//bit of the byte being clocked
+	int length;								//bytes in the transaction, known once the IDs have been read
+	ktime_t poll_start;						//time the poll started
+	unsigned int started;					//number of transactions started
+	unsigned int finished;					//number of transactions finished
+	wait_queue_head_t wait;					//pollers in process context waiting for a transaction to finish
+	uint8_t samples[PSX_MAX_TRANSFER_BYTES][8];	//raw status register samples of the transaction
+};
+
 struct psx_pad {
     int pad_num;							//number of pad 0-4
 	uint8_t pad_id;					//bits 7-4 = controller type, 3-0 = transfer byte(normal pad = 1)
 	uint8_t pad_status;				//should normally be 0x5a ('Z')
     // 16bit button_status maps to the two bytes for button status bytes 1 & 2
-    uint8_t button_status[2]; //| L  | DW | R  | UP | ST |  1 |  1 |SEL | [] |  X |  O | <| | R1 | L1 | R2 | L2 |
+    uint8_t button_status[2]; //| L  | DW | R  | UP | ST | R3 | L3 |SEL | [] |  X |  O | <| | R1 | L1 | R2 | L2 |
+    uint16_t reported_status;				//button status last reported to the input device
+    uint8_t axes[MAX_AXES];					//analog axes: right X, right Y, left X, left Y.  Centred on digital pads
+    uint8_t reported_axes[MAX_AXES];		//analog axes last reported to the input device
+    bool present;							//TRUE if pad answered the last poll with a valid ID and status
 	struct lintap_device* lintap;			//lintap this pad is attached to
-	struct input_dev* dev;					//kernel device pad is mapped to
+	struct input_dev __rcu* dev;			//kernel device pad is mapped to.  NULL while no pad is connected to the slot
 	int use_count;								//counts the number of times the device is opened/closed.  A positive count means in use
+	int missed_probes;						//number of consecutive probes the pad has been missing for
 };
 
 
 struct lintap_device {
 	bool port_claimed;						//TRUE if port has been claimed for use.  Should only be claimed if devices in use
 	struct pardevice* port_dev;				//pointer pardevice data structure
-	struct lintap_device* next; 			//next registered with driver
+	struct mutex lock;						//serialises claiming and releasing the port between pad open/close and probing
+	unsigned long bus_busy;					//bit 0 set while a busy waiting poll is using the bus, serialising the poller and LINTAP_IOC_POLL_NOW
+	wait_queue_head_t bus_wait;				//on demand polls waiting for the bus
+	bool periodic;							//TRUE if the port is polled periodically while claimed, otherwise only on request
+	bool use_engine;						//TRUE if polls are clocked by the timer engine rather than busy waiting
+	struct lintap_engine engine;			//timer engine state
+	struct delayed_work probe_work;			//periodically checks for pads being connected or disconnected
+	bool calibrated;						//TRUE once delays have been calibrated, or calibration was not wanted
+	unsigned int timing_ns[PHASES];			//time each phase of a transaction takes, edge to edge (nsecs)
+	unsigned int io_ns[TRANSFER_PATHS];		//measured time of one port access on each transfer path, 0 until measured (nsecs)
+	unsigned long io_base;					//base I/O address of the port if it is PC style, otherwise 0
+	int transfer_path;						//TRANSFER_PATH_DIRECT if registers are accessed directly, else TRANSFER_PATH_GENERIC
+	unsigned int transfer_ns[TRANSFER_PATHS];	//average time taken by a transaction on each transfer path (nsecs)
+	struct lintap_stats stats;				//performance statistics
+	struct dentry* debugfs_dir;				//debugfs directory with the statistics
+	struct hrtimer timer;					//drives the polls of this port, unless it has a polling thread
+	struct tasklet_struct poll_tasklet;		//polls the pads in softirq context each time the timer expires
+	s64 poll_scheduled_ns;					//expiry time of the timer event which scheduled the pending poll (nsecs).  Not a ktime_t, which ACCESS_ONCE can't read while it is a union
+	struct task_struct* poll_task;			//polling thread, only used instead of the timer when poll_thread is set
+	bool polling_active;					//TRUE while the timer or polling thread of this port is running.  hrtimer_active can't stand in for it, as it doesn't cover the thread
+	s64 last_poll_ns;						//time the last poll started, zero before the first poll (nsecs)
+	unsigned int poll_period_ns;			//measured average time between polls (nsecs)
+	unsigned int poll_jitter_ns;			//measured average deviation of the time between polls from the poll_hz period (nsecs)
+	s64 last_input_ns;						//time the pads last had input, for adaptive polling (nsecs).  Neither is a ktime_t, which ACCESS_ONCE can't read while it is a union
+	bool detached;							//TRUE once the port is going away, so it can't be claimed again
+	struct lintap_ring* ring;				//frame of every poll, shared with userspace through the character device.  NULL if there is no device
+	wait_queue_head_t ring_wait;			//readers of the character device waiting for a new frame
+	struct miscdevice ring_dev;				//character device for the ring, /dev/lintap-<port name>
+	char ring_name[32];						//name of the character device
+	int ring_users;							//number of times the character device is open.  A positive count means in use
+	struct lintap_capture_record* capture;	//last CAPTURE_RECORDS transactions, oldest overwritten first.  NULL if not capturing
+	u64 capture_head;						//number of transactions recorded so far
+	spinlock_t capture_lock;				//serialises recording against readers of the capture opening and closing it
+	int capture_readers;					//number of times the capture is open in debugfs.  Recording pauses while positive
+	struct lintap_capture_record* replay;	//records written to replay in debugfs, allocated on the first write
+	size_t replay_bytes;					//bytes of records written to replay
+	struct mutex replay_lock;				//serialises writing and replaying the records
+	struct kobject kobj;					//sysfs directory for the port under the module.  Owns the memory of the structure
+	struct list_head list;					//entry in lintap_list
+	struct input_dev __rcu* aggregate_dev;	//single input device for all the pads in aggregate mode.  NULL otherwise
+	int aggregate_users;					//number of times the aggregate device is open.  A positive count means in use
 	struct psx_pad pads[MAX_PADS];			//array of structures for available pads.  If NULL then no pad connected to respective slot
 };
 
@@ -104,11 +334,19 @@ struct lintap_device {
 static void attach_to_parport(struct parport* port);
 static void detach_from_parport(struct parport* port);
 
+static void start_lintap_polling(struct lintap_device* lintap);
+static void stop_lintap_polling(struct lintap_device* lintap);
+static void lintap_engine_idle(struct lintap_device* lintap);
+
 static int __init lintap_module_init(void);
 static void __exit lintap_module_exit(void);
 
 /* End Prototypes */
 
+// Tracepoints, which use psxpads_decode_byte
+#define CREATE_TRACE_POINTS
+#include "lintap_trace.h"
+
 /* Global Variables */
 static struct parport_driver lintap_driver = {
 	"LinTap",	//Name of parallel port driver
@@ -118,12 +356,22 @@ static struct parport_driver lintap_driver = {
 };
 
 static bool registered_with_parport = false;  // Indicates that driver has been registered with parralel port manager
-static struct lintap_device* lintap_list = NULL; //list of all device registrations
-static const uint16_t psxpad_button_events[MAX_BUTTONS] = { BTN_TL2, BTN_TR2, BTN_TL, BTN_TR, BTN_Y, BTN_X, BTN_B, BTN_A , BTN_START, BTN_SELECT };
-static const uint8_t psxpad_data_masks[MAX_PADS] = { PSX_DATA_0, PSX_DATA_1, PSX_DATA_2, PSX_DATA_3 };
+static bool registered_scratch_handler = false;	// TRUE once the handler which grabs scratch devices is registered
+static LIST_HEAD(lintap_list); //list of all device registrations
+static DEFINE_MUTEX(lintap_list_lock);  //serialises changes to lintap_list between attach, detach and module exit
+// Sticks of each pad on the aggregate device, in the same order.  The hats are taken by the d-pads
+// and the codes after ABS_BRAKE have no names, so the last five are tablet axes.  Without any pen
+// or touch buttons the device is still taken for a joystick
+static const uint16_t aggregate_axis_events[MAX_PADS][MAX_AXES] = { { ABS_X, ABS_Y, ABS_Z, ABS_RX },
+	{ ABS_RY, ABS_RZ, ABS_THROTTLE, ABS_RUDDER }, { ABS_WHEEL, ABS_GAS, ABS_BRAKE, ABS_PRESSURE },
+	{ ABS_DISTANCE, ABS_TILT_X, ABS_TILT_Y, ABS_TOOL_WIDTH } };
 static const char pad_name[] = "PSX Controller";
-static struct timer_list timer;	// timer function info.  Shared by all instances of lintap.  Initialised when module is loaded
-static bool timer_active = false;  // Indicates timer is in use
+static const char aggregate_name[] = "PSX Multitap";
+static const char scratch_name[] = "PSX Controller (lintap scratch)";
+static const char* const transfer_path_names[TRANSFER_PATHS] = { "generic", "direct" };
+static const char* const phase_names[PHASES] = { "select_setup", "clock_low", "clock_high", "byte_gap" };
+static const unsigned int phase_accesses[PHASES] = { 1, 2, 1, 0 };	//port accesses made during each phase, which take part of its time
+static struct dentry* debugfs_root = NULL;	// lintap directory in debugfs, holding a directory for each port
 
 /* End Global Variables */
 
@@ -141,70 +389,153 @@ static bool check_port_required(const struct lintap_device* lintap)
 		if (lintap->pads[pad_count].use_count > 0) { required = true; }
 		pad_count++;
 	}
+	if (lintap->ring_users > 0 || lintap->aggregate_users > 0) { required = true; }
 
 	return required;
 }
 
-// returns true if any lintap device has claim on any of the parallel ports
-static bool check_timer_required(const struct lintap_device* lintap)
+// Length of one poll period for the current poll_hz setting
+static inline u64 lintap_poll_period(void)
 {
-	bool required = false;
+    return NSEC_PER_SEC / ACCESS_ONCE(poll_hz);
+}
+
+// Update the measured poll period and jitter at the start of a poll.  Both are exponential
+// moving averages so they can be updated cheaply every poll without locking
+static void lintap_measure_poll(struct lintap_device* lintap, bool idle)
+{
+    const s64 now = ktime_to_ns(ktime_get());
 
-	while (lintap != NULL && !required)
+    if (lintap->last_poll_ns != 0)
     {
-		if (check_port_required(lintap)) { required = true; } // check if port is required - then timer is required
-		lintap = lintap->next;  //loop through next lintap port device driver
-	}
+        s64 period = now - lintap->last_poll_ns;
+        s64 jitter = period - (s64)lintap_poll_period();
+
+        if (jitter < 0) { jitter = -jitter; }
+        if (lintap->poll_period_ns == 0) { lintap->poll_period_ns = period; } // first measurement seeds the average
+        lintap->poll_period_ns += (s32)(period - lintap->poll_period_ns) >> POLL_STATS_SHIFT;
+        // Jitter is only measured against the full poll rate
+        if (!idle) { lintap->poll_jitter_ns += (s32)(jitter - lintap->poll_jitter_ns) >> POLL_STATS_SHIFT; }
+    }
+    lintap->last_poll_ns = now;
+}
 
-	return required;
+// Returns true if adaptive polling is on and the pads of the port have had no input for idle_timeout
+static bool lintap_port_idle(const struct lintap_device* lintap, ktime_t now)
+{
+    return ACCESS_ONCE(adaptive_poll) &&
+        ktime_to_ns(now) - ACCESS_ONCE(lintap->last_input_ns) >= (s64)ACCESS_ONCE(idle_timeout) * NSEC_PER_MSEC;
+}
+
+// In adaptive mode an idle port is only polled poll_hz_idle times a second.  Its poller keeps
+// running at the full rate and skips polls until an idle period has nearly passed since the last
+// one, so the idle rate is rounded to whole full rate periods, and the first input seen puts the
+// port straight back to polling at the full rate.  Returns true if this poll should be skipped
+static bool lintap_poll_skip(const struct lintap_device* lintap, ktime_t now)
+{
+    const s64 last_poll = ACCESS_ONCE(lintap->last_poll_ns);
+    const s64 idle_period = NSEC_PER_SEC / ACCESS_ONCE(poll_hz_idle);
+
+    if (last_poll == 0 || !lintap_port_idle(lintap, now)) { return false; }
+    // Allow half a full rate period for the last poll having started late
+    return ktime_to_ns(now) - last_poll < idle_period - (s64)(lintap_poll_period() / 2);
+}
+
+// Start timer events for the port, first one due a poll period from now
+static void enable_lintap_timer(struct lintap_device* lintap)
+{
+    hrtimer_start(&lintap->timer, ktime_add_ns(ktime_get(), lintap_poll_period()), HRTIMER_MODE_ABS);
+    debugk("Activating timer function for %s\n", lintap->port_dev->port->name);
+}
+
+static void disable_lintap_timer(struct lintap_device* lintap)
+{
+    hrtimer_cancel(&lintap->timer);
+    tasklet_kill(&lintap->poll_tasklet);
+    if (lintap->use_engine) { lintap_engine_idle(lintap); }
+    debugk("Timer deactivated for %s\n", lintap->port_dev->port->name);
+}
+
+// Port access used by the transfer functions.  These are always inlined with a constant direct
+// argument, so each transfer path gets its own copy of the transfer code with either plain
+// inb/outb on the registers of a PC style port, or calls through the port's parport operations.
+static __always_inline void lintap_write_data(const struct lintap_device* lintap, bool direct, uint8_t data)
+{
+	if (direct) { outb(data, lintap->io_base + PC_DATA_REGISTER); }
+	else { parport_write_data(lintap->port_dev->port, data); }
 }
 
-// Reschedule timer event
-static void enable_lintap_timer(void)
+static __always_inline uint8_t lintap_read_status(const struct lintap_device* lintap, bool direct)
 {
-    // Set enabled flag first before adding timer, so that flag is set before timer interrupts anything
-    timer_active = true;
-    // Set enabled flag first before adding timer, so that flag is set before timer interrupts anything
-    mod_timer(&timer, jiffies + GC_REFRESH_TIME);
-    debugk("Activating timer function\n");
+	if (direct) { return inb(lintap->io_base + PC_STATUS_REGISTER); }
+	else { return parport_read_status(lintap->port_dev->port); }
 }
 
-static void disable_lintap_timer(void)
+// Busy waits for each phase of a transaction on a transfer path, which are the phase timings less
+// the time taken by the port accesses made during each phase, so the timings are the real spacing
+// of the edges
+static __always_inline void lintap_phase_delays(const struct lintap_device* lintap, bool direct, unsigned int delays[PHASES])
 {
-    del_timer_sync(&timer);
-    // Set disabled flag first after deleting timer, so that flag truly reflects timer state
-    timer_active = false;
-    // Set disabled flag first after deleting timer, so that flag truly reflects timer state
-    debugk("Timer deactivated\n");
+	const unsigned int io_ns = ACCESS_ONCE(lintap->io_ns[direct ? TRANSFER_PATH_DIRECT : TRANSFER_PATH_GENERIC]);
+	int phase;
+
+	for (phase = 0; phase < PHASES; phase++)
+	{
+		const unsigned int timing = ACCESS_ONCE(lintap->timing_ns[phase]);
+		const unsigned int io = phase_accesses[phase] * io_ns;
+
+		delays[phase] = timing > io ? timing - io : 0;
+	}
 }
 
-static void psxpads_select(const struct lintap_device* lintap) {
-	struct parport* port = lintap->port_dev->port;
+// Measure how long one access to the port takes on each transfer path it can use.  Only the
+// status register is read, which the pads don't notice.  The port must be claimed
+static void lintap_measure_io(struct lintap_device* lintap)
+{
+	int path, run, count;
+
+	for (path = 0; path < TRANSFER_PATHS; path++)
+	{
+		u64 quickest = ULLONG_MAX;
+
+		if (path == TRANSFER_PATH_DIRECT && lintap->io_base == 0) { continue; }
+		for (run = 0; run < IO_MEASURE_RUNS; run++)
+		{
+			const ktime_t start = ktime_get();
 
+			for (count = 0; count < IO_MEASURE_ACCESSES; count++) { lintap_read_status(lintap, path == TRANSFER_PATH_DIRECT); }
+			quickest = min_t(u64, quickest, ktime_to_ns(ktime_sub(ktime_get(), start)));
+		}
+		ACCESS_ONCE(lintap->io_ns[path]) = div_u64(quickest, IO_MEASURE_ACCESSES);
+	}
+}
+
+static __always_inline void psxpads_select(const struct lintap_device* lintap, bool direct, const unsigned int delays[PHASES]) {
 	// send select high to all pads, then lower select edge
-	parport_write_data(port, PSX_CLOCK|PSX_SELECT_ALL);
-	udelay(bit_delay);	// wait some time for parallel port
+	lintap_write_data(lintap, direct, PSX_CLOCK|PSX_SELECT_ALL);
+	ndelay(delays[PHASE_SELECT_SETUP]);	// wait some time for parallel port
 	// set selected pad low and clock high and command high
-	parport_write_data(port, PSX_CLOCK);
-	udelay(bit_delay);	//wait some time for parallel port
+	lintap_write_data(lintap, direct, PSX_CLOCK);
+	ndelay(delays[PHASE_SELECT_SETUP]);	//wait some time for parallel port
 }
 
 // sends select high to all pads, sets clock high
-static void psxpads_deselect(const struct lintap_device* lintap) {
+static __always_inline void psxpads_deselect(const struct lintap_device* lintap, bool direct) {
 
-	parport_write_data(lintap->port_dev->port, PSX_CLOCK|PSX_SELECT_ALL);
+	lintap_write_data(lintap, direct, PSX_CLOCK|PSX_SELECT_ALL);
 	//udelay(PSX_DELAY); // DOESN'T seemt to be required	//wait some time for parallel port
 }
 
 // Claim the parallel port that the lintap device is registererd against
-// Enable the timer if it isn't already
+// Start polling the port if it isn't already
 static bool lintap_claim_port(struct lintap_device* lintap)
 {
     if (parport_claim(lintap->port_dev) == 0)
     {
         lintap->port_claimed = true;
+        lintap_measure_io(lintap);
         debugk("Parport %s claimed\n", lintap->port_dev->port->name);
-        if (!timer_active) { enable_lintap_timer(); }
+        if (lintap->periodic && !lintap->polling_active) { start_lintap_polling(lintap); }
         return true;
     }
     else { return false; }
@@ -218,12 +549,32 @@ static void lintap_release_port(struct lintap_device* lintap)
     lintap->port_claimed = false; //make note of this with status flag
 }
 
+// Stop polling and release the parallel port once no pads or readers of the character device
+// are using it.  Must be called with the lock held
+static void lintap_put_port(struct lintap_device* lintap)
+{
+    if (lintap->port_claimed && !check_port_required(lintap))
+    {
+        // Stop polling first before releasing parallel port
+        if (lintap->polling_active) { stop_lintap_polling(lintap); }
+        lintap_release_port(lintap);
+    }
+}
+
 // Claim parallel port if not already claimed
 static int psxpad_open(struct input_dev* dev)
 {
 	struct psx_pad* pad = (struct psx_pad*)input_get_drvdata(dev); //get handle to respective pad structure for device
+	int ret = 0;
 	debugk("Call to pad open for pad %d\n", pad->pad_num);
 
+	mutex_lock(&pad->lintap->lock);
+	if (pad->lintap->detached)
+    {
+		// Port is going away, don't claim it again
+		mutex_unlock(&pad->lintap->lock);
+		return -ENODEV;
+	}
 	pad->use_count++;
     // if use count was zero and is now one, port needs to be claimed to use pad if it hasn't already been claimed
 	if (pad->use_count == 1 && !pad->lintap->port_claimed)
@@ -232,96 +583,279 @@ static int psxpad_open(struct input_dev* dev)
         {
             // If claiming port failed, set pad use count to zero and return busy
             pad->use_count = 0;
-            return -EBUSY;
+            ret = -EBUSY;
         }
     }
-	return 0;
+	mutex_unlock(&pad->lintap->lock);
+	return ret;
 }
 
 // Close pad device.  Decrement use count for the pad.  If use count reaches zero, then check
-// if any other pads on same lintap device are in use.  If not, then release the parallel port
-// and check if any other lintaps still need timer.  If not, disable timer function
+// if any other pads on same lintap device are in use.  If not, then stop the timer or polling
+// thread of the port and release the parallel port.  Other ports keep their own pollers running
 static void psxpad_close(struct input_dev* dev) {
 	struct psx_pad* pad = (struct psx_pad*)input_get_drvdata(dev); //dev->private;  //get handle to respective pad structure for device
 	struct lintap_device* lintap = pad->lintap;
 	debugk("Call to pad close for pad %d\n", pad->pad_num);
+	mutex_lock(&lintap->lock);
 	pad->use_count--;
-	if (pad->use_count == 0 && lintap->port_claimed && !check_port_required(lintap))
+	if (pad->use_count == 0) { lintap_put_port(lintap); }
+	mutex_unlock(&lintap->lock);
+}
+
+// Open and close of the aggregate device, which claim and release the port like a pad
+static int lintap_aggregate_open(struct input_dev* dev)
+{
+	struct lintap_device* lintap = (struct lintap_device*)input_get_drvdata(dev);
+	int ret = 0;
+
+	mutex_lock(&lintap->lock);
+	if (lintap->detached) { ret = -ENODEV; }
+	else if (!lintap->port_claimed && !lintap_claim_port(lintap)) { ret = -EBUSY; }
+	else { lintap->aggregate_users++; }
+	mutex_unlock(&lintap->lock);
+	return ret;
+}
+
+static void lintap_aggregate_close(struct input_dev* dev)
+{
+	struct lintap_device* lintap = (struct lintap_device*)input_get_drvdata(dev);
+
+	mutex_lock(&lintap->lock);
+	lintap->aggregate_users--;
+	if (lintap->aggregate_users == 0) { lintap_put_port(lintap); }
+	mutex_unlock(&lintap->lock);
+}
+
+// Waits for the pads to acknowledge the byte just sent.  The ACK lines of all the pads share one
+// status bit, which stays set while any pad is still holding ACK low, so once it has been set and
+// cleared again every pad which answered has finished.  Returns false if no pad acknowledged
+// within ack_timeout usecs
+static __always_inline bool psxpads_wait_ack(const struct lintap_device* lintap, bool direct)
+{
+	const s64 deadline = ktime_to_ns(ktime_get()) + (s64)ACCESS_ONCE(ack_timeout) * NSEC_PER_USEC;
+
+	while (!(lintap_read_status(lintap, direct) & PSX_ACKNOWLEDGE))
     {
-        // Stop timer first before releasing parallel port
-        if (timer_active && !check_timer_required(lintap_list)) { disable_lintap_timer(); }
-        lintap_release_port(lintap);
-    }
+		if (ktime_to_ns(ktime_get()) > deadline) { return false; }
+	}
+	while (lintap_read_status(lintap, direct) & PSX_ACKNOWLEDGE)
+    {
+		if (ktime_to_ns(ktime_get()) > deadline) { break; }
+	}
+	return true;
 }
 
-static void psxpads_send_command(const struct lintap_device* lintap, uint8_t command, uint8_t store[MAX_PADS]) {
-	//takes a byte command as an argument, sends bit by bit on command pin, and returns resultant 4 data bytes for all 4 pads
+// Takes a byte command as an argument and sends it bit by bit on the command pin.  Only the raw
+// status register is sampled for each bit, into samples, so nothing but the phase delays separates
+// the clock edges.  The samples are turned into bytes for each pad by psxpads_decode_byte once the
+// transaction is over and the pads have been deselected.
+// In handshake mode the clock high delay after the last bit is left out, as the pads' acknowledge
+// starts a few usecs after the last rising edge and is only a few usecs long, so waiting for it
+// has to start as soon as the clock goes high.
+static __always_inline void psxpads_send_command(const struct lintap_device* lintap, bool direct, const unsigned int delays[PHASES],
+	bool handshake, uint8_t command, uint8_t samples[8]) {
 	int bit_count;
-	struct parport* port = lintap->port_dev->port;
 
-	memset(store, 0, MAX_PADS);
     debugk("Sending command %x\n", command);
 
 	for (bit_count = 0; bit_count < 8; bit_count++)
     {
-		uint8_t data = 0;
 		uint8_t commbyte = command & 0x01;
-		int pad_count = 0;
-		parport_write_data(port, commbyte); //transmit least significant bit of command, on data pin 0clock is low
-		udelay(bit_delay);	//wait per usual
-
-		data = parport_read_status(port); //read next stream of bits coming from all pads
+		lintap_write_data(lintap, direct, commbyte); //transmit least significant bit of command, on data pin 0clock is low
+		ndelay(delays[PHASE_CLOCK_LOW]);	//wait per usual
 
-		for (pad_count = 0; pad_count < MAX_PADS; pad_count++) {
-			store[pad_count] |= ( data & psxpad_data_masks[pad_count]) ? (1 << bit_count) : 0;
-		}
+		samples[bit_count] = lintap_read_status(lintap, direct); //read next stream of bits coming from all pads
 
 		commbyte |= PSX_CLOCK;	//command bit must be sent again? but with clock high again
-		parport_write_data(port, commbyte);  //set clock high
-		udelay(bit_delay);
+		lintap_write_data(lintap, direct, commbyte);  //set clock high
+		if (!handshake || bit_count < 7) { ndelay(delays[PHASE_CLOCK_HIGH]); }
 		command >>= 1; //shift command once right
 	}
+}
 
-	udelay(cmd_delay);
+// Gap after each byte of a transaction.  Either waits the byte gap, or in handshake mode waits for
+// the pads' acknowledge, straight after the last rising clock edge.  Pads never acknowledge the
+// last byte of a transaction, so that just gets the clock high time send_command left out.
+// Returns false if no pad acknowledged.
+static __always_inline bool psxpads_end_byte(const struct lintap_device* lintap, bool direct, const unsigned int delays[PHASES],
+	bool handshake, bool last)
+{
+	if (!handshake) { ndelay(delays[PHASE_BYTE_GAP]); }
+	else if (!last) { return psxpads_wait_ack(lintap, direct); }
+	else { ndelay(delays[PHASE_CLOCK_HIGH]); }
 
+	return true;
 }
 
-// Read the ID and working status of the pad, and the status of all axes and buttons
-// from the device into the psx_pad structure
-static void psxpads_read_status(struct lintap_device* lintap) {
-	uint8_t id[MAX_PADS],status[MAX_PADS],buttons_1[MAX_PADS],buttons_2[MAX_PADS],temp[MAX_PADS];
-	int pad_count;
+// Clock a whole status transaction and capture the raw samples for every byte of it.  Returns the
+// number of bytes transferred.  The bytes sent are start (get pads' attentions) and transfer
+// (request status transfer from all pads), then the IDs the pads sent back decide how many more
+// bytes, for the status and payload, are clocked in.  If no pad acknowledges a byte the
+// transaction ends there.  Bytes never read are left as no pad (all bits high).
+static __always_inline int psxpads_capture(const struct lintap_device* lintap, bool direct, uint8_t samples[PSX_MAX_TRANSFER_BYTES][8])
+{
+	int byte_count, length = PSX_MAX_TRANSFER_BYTES;
+	unsigned int delays[PHASES];
+	const bool handshake = ACCESS_ONCE(ack_handshake);
+	bool acknowledged;
 
-	psxpads_select(lintap);
+	memset(samples, 0xFF, PSX_MAX_TRANSFER_BYTES * 8);
+	lintap_phase_delays(lintap, direct, delays);
+	psxpads_select(lintap, direct, delays);
+	trace_lintap_select(lintap->port_dev->port->name);
 
 	debugk("Sending start command\n");
 
-	psxpads_send_command(lintap, PSX_COMMAND_START, temp);			//get pads' attentions
+	for (byte_count = 0; byte_count < length; byte_count++)
+    {
+		psxpads_send_command(lintap, direct, delays, handshake, psx_status_commands[byte_count], samples[byte_count]);
+		if (byte_count == PSX_BYTE_ID) { length = psxpads_transfer_length(samples[PSX_BYTE_ID]); }
+		acknowledged = psxpads_end_byte(lintap, direct, delays, handshake, byte_count == length - 1);
+		// Traced after the gap, so tracing doesn't delay the wait for the acknowledge
+		trace_lintap_byte(lintap->port_dev->port->name, byte_count, psx_status_commands[byte_count], samples[byte_count]);
+		if (!acknowledged)
+        {
+			debugk("No acknowledge for byte %d, ending transaction\n", byte_count);
+			byte_count++;
+			break;
+		}
+	}
+
+	psxpads_deselect(lintap, direct);
+	trace_lintap_deselect(lintap->port_dev->port->name, byte_count);
+	return byte_count;
+}
+
+// The two transfer paths, each with the transfer code specialised for its kind of port access
+static noinline int psxpads_capture_direct(const struct lintap_device* lintap, uint8_t samples[PSX_MAX_TRANSFER_BYTES][8])
+{
+	return psxpads_capture(lintap, true, samples);
+}
+
+static noinline int psxpads_capture_generic(const struct lintap_device* lintap, uint8_t samples[PSX_MAX_TRANSFER_BYTES][8])
+{
+	return psxpads_capture(lintap, false, samples);
+}
+
+// Count a time in its log2 histogram bucket
+static inline void lintap_stats_histogram(u32 histogram[STATS_HISTOGRAM_BUCKETS], s64 time_ns)
+{
+	histogram[min(fls64(max_t(s64, time_ns, 0)), STATS_HISTOGRAM_BUCKETS - 1)]++;
+}
+
+// Count a transaction which took elapsed nsecs in the statistics
+static void lintap_transfer_stats(struct lintap_device* lintap, s64 elapsed)
+{
+	lintap->stats.transfers++;
+	lintap->stats.transfer_ns_total += elapsed;
+	lintap->stats.transfer_ns_max = max_t(u64, lintap->stats.transfer_ns_max, elapsed);
+	lintap_stats_histogram(lintap->stats.transfer_histogram, elapsed);
+}
+
+// Decode the raw samples of a transaction of length bytes, and store the ID and working
+// status of each pad, and the status of all its axes and buttons, in its psx_pad structure
+static void psxpads_store_status(struct psx_pad pads[MAX_PADS], const uint8_t samples[PSX_MAX_TRANSFER_BYTES][8], int length)
+{
+	uint8_t data[PSX_MAX_TRANSFER_BYTES][MAX_PADS];
+	int byte_count, pad_count;
 
-	psxpads_send_command(lintap, PSX_COMMAND_TRANSFER, id);  //request status transfer from all pads
-	psxpads_send_command(lintap, 0, status);			//get pad status
-	psxpads_send_command(lintap, 0, buttons_1);		//get first lot of buttons
-	psxpads_send_command(lintap, 0, buttons_2);		//get second load of buttons
+	for (byte_count = 0; byte_count < length; byte_count++) { psxpads_decode_byte(samples[byte_count], data[byte_count]); }
+	memset(data[length], 0xFF, (PSX_MAX_TRANSFER_BYTES - length) * MAX_PADS);
 
 	for (pad_count = 0;pad_count < MAX_PADS; pad_count++)
     {
-        struct psx_pad* pad = &lintap->pads[pad_count];
-
-        pad->pad_id = id[pad_count];
-        pad->pad_status = status[pad_count];
-        // check if we have the right pad type and it is present, and read status from pad
-        if (pad->pad_id == PSX_NORMAL_PAD_ID && pad->pad_status == PSX_NORMAL_STATUS)
+        struct psx_pad* pad = &pads[pad_count];
+        int payload, axis_count;
+
+        pad->pad_id = data[PSX_BYTE_ID][pad_count];
+        pad->pad_status = data[PSX_BYTE_STATUS][pad_count];
+        payload = psxpad_payload_bytes(pad->pad_id);
+        // check if we have a known pad type and it is present, and read status from pad
+        pad->present = (payload != 0 && pad->pad_status == PSX_NORMAL_STATUS);
+        if (pad->present)
         {
-			pad->button_status[0] = buttons_1[pad_count];
-			pad->button_status[1] = buttons_2[pad_count];
+			pad->button_status[0] = data[PSX_BYTE_BUTTONS][pad_count];
+			pad->button_status[1] = data[PSX_BYTE_BUTTONS + 1][pad_count];
 		}
 		else
         {
-            pad->button_status[0] = pad->button_status[1] = 0xFF; // Set all bits high (pretend there is no pad)
+            *((uint16_t*)pad->button_status) = PSX_BUTTONS_RELEASED; // Set all bits high (pretend there is no pad)
+        }
+        // Axes are only read from pads which sent them, otherwise they are left centred
+        for (axis_count = 0; axis_count < MAX_AXES; axis_count++)
+        {
+            const bool has_axis = pad->present && PSX_BYTE_AXES + axis_count < PSX_BYTE_BUTTONS + payload;
+            pad->axes[axis_count] = has_axis ? data[PSX_BYTE_AXES + axis_count][pad_count] : PSX_AXIS_CENTRE;
         }
     }
+}
+
+// Copy the state of the pads into the frames given, returning the mask of pads present
+static u32 psxpads_store_frame(const struct psx_pad pads[MAX_PADS], struct lintap_pad_frame frames[MAX_PADS])
+{
+    u32 present_mask = 0;
+    int pad_count;
+
+    for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+    {
+        const struct psx_pad* pad = &pads[pad_count];
+        struct lintap_pad_frame* frame = &frames[pad_count];
+
+        if (pad->present) { present_mask |= 1 << pad_count; }
+        frame->pad_id = pad->pad_id;
+        frame->pad_status = pad->pad_status;
+        memcpy(frame->button_status, pad->button_status, sizeof(frame->button_status));
+        memcpy(frame->axes, pad->axes, MAX_AXES);
+    }
+    return present_mask;
+}
+
+// Record a polled transaction which started at timestamp, with the pads as just decoded from it,
+// if the port is capturing.  Probes and calibration aren't recorded, so a capture replays only
+// what was reported.  Recording is skipped while the capture is being read, so readers see it
+// unchanged.  Transactions can end in hard interrupt context on the timer engine
+static void lintap_capture_write(struct lintap_device* lintap, ktime_t timestamp, const uint8_t samples[PSX_MAX_TRANSFER_BYTES][8], int length)
+{
+    struct lintap_capture_record* record;
+    unsigned long flags;
+
+    if (lintap->capture == NULL) { return; }
+    spin_lock_irqsave(&lintap->capture_lock, flags);
+    if (lintap->capture_readers == 0)
+    {
+        record = &lintap->capture[lintap->capture_head % CAPTURE_RECORDS];
+        record->timestamp_ns = ktime_to_ns(timestamp);
+        record->length = length;
+        memcpy(record->samples, samples, sizeof(record->samples));
+        record->present_mask = psxpads_store_frame(lintap->pads, record->pads);
+        lintap->capture_head++;
+    }
+    spin_unlock_irqrestore(&lintap->capture_lock, flags);
+}
 
-	psxpads_deselect(lintap);
+// Read the ID and working status of the pad, and the status of all axes and buttons
+// from the device into the psx_pad structure.  The raw samples for the whole transaction
+// are captured first, and only decoded once the pads have been released.
+// The time each transaction takes is averaged separately for each transfer path.
+// Only transactions of polls are captured
+static void psxpads_read_status(struct lintap_device* lintap, bool polled) {
+	uint8_t samples[PSX_MAX_TRANSFER_BYTES][8];
+	int length;
+	const int path = ACCESS_ONCE(lintap->transfer_path);
+	const ktime_t start = ktime_get();
+	s64 elapsed;
+
+	if (path == TRANSFER_PATH_DIRECT) { length = psxpads_capture_direct(lintap, samples); }
+	else { length = psxpads_capture_generic(lintap, samples); }
+
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (lintap->transfer_ns[path] == 0) { lintap->transfer_ns[path] = elapsed; }
+	else { lintap->transfer_ns[path] += (s32)(elapsed - lintap->transfer_ns[path]) >> POLL_STATS_SHIFT; }
+	lintap_transfer_stats(lintap, elapsed);
+
+	psxpads_store_status(lintap->pads, samples, length);
+	if (polled) { lintap_capture_write(lintap, start, samples, length); }
 }
 
 static struct input_dev* input_device_new(const char *name, unsigned bus, unsigned vendor, unsigned prod, unsigned ver,
@@ -346,189 +880,1701 @@ static struct input_dev* input_device_new(const char *name, unsigned bus, unsign
 }
 
 
-static bool register_psxpad_device(struct psx_pad* pad) {  //returns TRUE if successfull, else false
-	//Create the input device structure
-	pad->dev = input_device_new(pad_name, BUS_PARPORT, 0x0001, PSX_PAD_ID, LINTAP_VERSION, pad, psxpad_open, psxpad_close);
+// Set the events a pad input device can send
+static void psxpad_device_setup(struct input_dev* dev)
+{
+	int event_count;
+	//Assign event information
+	dev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_ABS);  //set device capable of key(button) and absolute movement events
 
-	if (pad->dev != NULL)
-    {
-		int event_count;
-		//Assign event information
-		pad->dev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_ABS);  //set device capable of key(button) and absolute movement events
+	for (event_count=0;event_count<MAX_BUTTONS;event_count++) {
+		__set_bit(psxpad_button_events[event_count], dev->keybit);  //set possible key events for this input device
+	}
 
-		for (event_count=0;event_count<MAX_BUTTONS;event_count++) {
-			__set_bit(psxpad_button_events[event_count], pad->dev->keybit);  //set possible key events for this input device
-		}
+    // New ABS info for kernel 3
+    input_set_abs_params(dev, ABS_X, -255, 255, 0, 0);
+    input_set_abs_params(dev, ABS_Y, -255, 255, 0, 0);
+    // Analog sticks.  Every pad has them, as DualShocks can switch between digital and analog
+    for (event_count = 0; event_count < MAX_AXES; event_count++)
+    {
+        input_set_abs_params(dev, psxpad_axis_events[event_count], 0, 255, PSX_AXIS_FUZZ, 0);
+        input_abs_set_val(dev, psxpad_axis_events[event_count], PSX_AXIS_CENTRE);
+    }
+}
 
-        // New ABS info for kernel 3
-        input_set_abs_params(pad->dev, ABS_X, -255, 255, 0, 0);
-        input_set_abs_params(pad->dev, ABS_Y, -255, 255, 0, 0);
+// Create and register the input device for a pad which has just been connected.  The device
+// is only published to the poller once registration has succeeded
+static bool register_psxpad_device(struct psx_pad* pad) {  //returns TRUE if successfull, else false
+	//Create the input device structure
+	struct input_dev* dev = input_device_new(pad_name, BUS_PARPORT, 0x0001, PSX_PAD_ID, LINTAP_VERSION, pad, psxpad_open, psxpad_close);
 
-        input_register_device(pad->dev);
+	if (dev != NULL)
+    {
+		psxpad_device_setup(dev);
+        if (input_register_device(dev) != 0)
+        {
+            input_free_device(dev);
+            return false;
+        }
 		debugk("Registered pad input device\n");
 
+        // New device starts with nothing pressed, so reports must start from there too
+        pad->reported_status = PSX_BUTTONS_RELEASED;
+        memset(pad->reported_axes, PSX_AXIS_CENTRE, MAX_AXES);
+        rcu_assign_pointer(pad->dev, dev);
 		return true;
 	}
 	else { return false; }
 }
 
-static void lintap_timer_func(unsigned long private) {
-	struct lintap_device *lintap = *((struct lintap_device**)private);
-
-    while (lintap != NULL)
-    {
-   		debugk("Timer running\n");
-		if (lintap->port_claimed)
-        { //only do input checking if the parallel port has been claimed for use
-            int pad_count = 0;
-
-			psxpads_read_status(lintap); //get status from pad
-			for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
-            {
-				int button_count = 0;
-				const struct psx_pad* pad = &lintap->pads[pad_count];   //get handle to current pad
-				struct input_dev* dev = pad->dev;				//get pointer to device structure
-				const uint16_t button_status = *((uint16_t*)pad->button_status);
-                const int abs_x = 0 + (button_status & PSX_RIGHT ? 0 : 255) - (button_status & PSX_LEFT ? 0 : 255);
-                const int abs_y = 0 + (button_status & PSX_DOWN ? 0 : 255) - (button_status & PSX_UP ? 0 : 255);
+// Remove the input device of a pad which has been disconnected.  Waits for any poll still
+// reporting to the device to finish before unregistering it
+static void unregister_psxpad_device(struct psx_pad* pad)
+{
+    struct input_dev* dev = rcu_dereference_protected(pad->dev, true);
 
-                debugk("lintap pad num: %d, axis x: %d, axis y: %d\n", pad_count, abs_x, abs_y);
+    RCU_INIT_POINTER(pad->dev, NULL);
+    synchronize_rcu();
+    input_unregister_device(dev);
+    debugk("Unregistered pad input device\n");
+}
 
-                input_report_abs(dev, ABS_X, abs_x);
-				input_report_abs(dev, ABS_Y, abs_y);
+// Input handler which grabs every scratch device as it is registered, so the events reported to
+// them only ever reach its empty event function, and not joydev, evdev or any program reading them
+static void lintap_scratch_event(struct input_handle* handle, unsigned int type, unsigned int code, int value)
+{
+}
 
-				for (button_count = 0; button_count < MAX_BUTTONS - 2; button_count++) {
-					input_report_key(dev, psxpad_button_events[button_count], ~button_status & (0x0100 << button_count));
-				}
+static int lintap_scratch_connect(struct input_handler* handler, struct input_dev* dev, const struct input_device_id* id)
+{
+	struct input_handle* handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	int ret;
+
+	if (handle == NULL) { return -ENOMEM; }
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = handler->name;
+	ret = input_register_handle(handle);
+	if (ret != 0) { goto err_free; }
+	ret = input_open_device(handle);
+	if (ret != 0) { goto err_unregister; }
+	ret = input_grab_device(handle);
+	if (ret != 0) { goto err_close; }
+	return 0;
 
-				input_report_key(dev, psxpad_button_events[MAX_BUTTONS - 2],  ~button_status & PSX_START);
-				input_report_key(dev, psxpad_button_events[MAX_BUTTONS - 1], ~button_status & PSX_SELECT);
+err_close:
+	input_close_device(handle);
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return ret;
+}
 
-				input_sync(dev);
-   			}
-		}
+static void lintap_scratch_disconnect(struct input_handle* handle)
+{
+	input_release_device(handle);
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
 
-		lintap = lintap->next;
+static const struct input_device_id lintap_scratch_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_BUS | INPUT_DEVICE_ID_MATCH_VENDOR | INPUT_DEVICE_ID_MATCH_PRODUCT,
+		.bustype = BUS_PARPORT,
+		.vendor = 0x0001,
+		.product = PSX_SCRATCH_ID,
+	},
+	{ },
+};
 
-	} //End while loop for ports
+static struct input_handler lintap_scratch_handler = {
+	.event = lintap_scratch_event,
+	.connect = lintap_scratch_connect,
+	.disconnect = lintap_scratch_disconnect,
+	.name = "lintap_scratch",
+	.id_table = lintap_scratch_ids,
+};
 
-	enable_lintap_timer(); //reactivate timer function
+// Create and register an input device for reports made outside the poller, such as by the
+// benchmark.  Events are only delivered by registered devices, so it has to be a real one.  It is
+// named so it isn't taken for a connected pad, and lintap_scratch_handler grabs it, so nothing
+// outside the driver gets its events.  Returns NULL if it can't be registered or grabbed.
+// Unregister it with input_unregister_device when done
+static struct input_dev* register_scratch_device(struct psx_pad* pad)
+{
+	struct input_dev* dev;
+	struct input_handle* grab;
+	bool grabbed;
+
+	if (!registered_scratch_handler) { return NULL; }
+	dev = input_device_new(scratch_name, BUS_PARPORT, 0x0001, PSX_SCRATCH_ID, LINTAP_VERSION, pad, NULL, NULL);
+	if (dev == NULL) { return NULL; }
+	psxpad_device_setup(dev);
+	if (input_register_device(dev) != 0)
+	{
+		input_free_device(dev);
+		return NULL;
+	}
+	// Someone else may have grabbed it first, in which case they would get the events
+	rcu_read_lock();
+	grab = rcu_dereference(dev->grab);
+	grabbed = grab != NULL && grab->handler == &lintap_scratch_handler;
+	rcu_read_unlock();
+	if (!grabbed)
+	{
+		input_unregister_device(dev);
+		return NULL;
+	}
+	return dev;
 }
 
-static void init_psxpads(struct lintap_device *lintap) {
-	int pad_count;
-
-	for (pad_count = 0; pad_count<MAX_PADS; pad_count++) {
-		struct psx_pad *new_pad = &lintap->pads[pad_count];
+// Button event of a pad's button on the aggregate device.  The first AGGREGATE_BUTTONS of each pad
+// fill BTN_TRIGGER_HAPPY1 to BTN_TRIGGER_HAPPY40, and L3 and R3 go from BTN_0 on
+static inline unsigned int lintap_aggregate_button(int pad_count, int button_count)
+{
+	if (button_count < AGGREGATE_BUTTONS) { return BTN_TRIGGER_HAPPY1 + pad_count * AGGREGATE_BUTTONS + button_count; }
+	return BTN_0 + pad_count * (MAX_BUTTONS - AGGREGATE_BUTTONS) + button_count - AGGREGATE_BUTTONS;
+}
 
-		if (new_pad) {
-			memset(new_pad, 0, sizeof(struct psx_pad));
-			new_pad->lintap = lintap;	//make the pad belong to the current lintap
-			new_pad->pad_num = pad_count;
-			register_psxpad_device(new_pad);
-        }
+// Create and register the aggregate device of a port.  Each pad gets all its buttons, its own hat
+// for the d-pad and four axes for its sticks.  The device stays for as long as the port, whichever
+// pads are connected.  If it can't be registered the port falls back to a device per pad, as the
+// probe work only registers those while there is no aggregate device
+static void lintap_aggregate_init(struct lintap_device* lintap)
+{
+	struct input_dev* dev = input_device_new(aggregate_name, BUS_PARPORT, 0x0001, PSX_AGGREGATE_ID, LINTAP_VERSION, lintap,
+		lintap_aggregate_open, lintap_aggregate_close);
+	int pad_count, button_count, axis_count;
+
+	if (dev != NULL)
+	{
+		dev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_ABS);
+		for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+		{
+			for (button_count = 0; button_count < MAX_BUTTONS; button_count++) { __set_bit(lintap_aggregate_button(pad_count, button_count), dev->keybit); }
+			input_set_abs_params(dev, ABS_HAT0X + pad_count * 2, -1, 1, 0, 0);
+			input_set_abs_params(dev, ABS_HAT0Y + pad_count * 2, -1, 1, 0, 0);
+			for (axis_count = 0; axis_count < MAX_AXES; axis_count++)
+			{
+				input_set_abs_params(dev, aggregate_axis_events[pad_count][axis_count], 0, 255, PSX_AXIS_FUZZ, 0);
+				input_abs_set_val(dev, aggregate_axis_events[pad_count][axis_count], PSX_AXIS_CENTRE);
+			}
+		}
+		if (input_register_device(dev) == 0)
+		{
+			rcu_assign_pointer(lintap->aggregate_dev, dev);
+			return;
+		}
+		input_free_device(dev);
 	}
+	printk(KERN_ERR "lintap: %s failed to register aggregate input device, using one per pad\n", lintap->port_dev->port->name);
 }
 
-// Create timer with address of timer_list (pointer to pointer to list object)
-// THIS FUNCTION MARKED __init so that it will be dropped from memory after module initialisation finished
-static void __init init_lintap_timer(struct timer_list* ptr_timer, struct lintap_device** lintap_list_address)
+static void lintap_aggregate_remove(struct lintap_device* lintap)
 {
-    memset(ptr_timer, 0, sizeof(struct timer_list));
-    init_timer_on_stack(ptr_timer);
-    ptr_timer->data = (long)lintap_list_address;
-    ptr_timer->function = lintap_timer_func;
+	struct input_dev* dev = rcu_dereference_protected(lintap->aggregate_dev, true);
+
+	RCU_INIT_POINTER(lintap->aggregate_dev, NULL);
+	synchronize_rcu();
+	input_unregister_device(dev);
 }
 
+// Add a frame with the state of the pads just read to the ring, and wake up any readers waiting
+// for it.  Frames are only written by the poll owning the bus, so the seqcount just guards against readers
+static void lintap_ring_write(struct lintap_device* lintap, ktime_t timestamp)
+{
+    struct lintap_ring* ring = lintap->ring;
+    const u64 sequence = ring->header.head + 1;
+    struct lintap_frame* frame = &ring->frames[sequence % LINTAP_RING_FRAMES];
+
+    ring->header.seqcount++;
+    smp_wmb();
+    frame->timestamp_ns = ktime_to_ns(timestamp);
+    frame->sequence = sequence;
+    frame->present_mask = psxpads_store_frame(lintap->pads, frame->pads);
+    smp_wmb();
+    ring->header.head = sequence;
+    ring->header.seqcount++;
+    wake_up_interruptible(&lintap->ring_wait);
+}
 
-static void attach_to_parport(struct parport* port) {
-	struct lintap_device* new_lintap = (struct lintap_device*)kmalloc(sizeof(struct lintap_device), GFP_KERNEL);
-#ifdef DEBUG
-	printk("New parallel port is available for register!\n"); printk(" - Name: %s\n",port->name); printk(" - Number: %d\n",port->number);
-	printk("Available modes :");if (port->modes&PARPORT_MODE_PCSPP)	{ printk("SPP "); } if (port->modes&PARPORT_MODE_TRISTATE) { printk("TRISTATE "); }
-	if (port->modes&PARPORT_MODE_COMPAT) { printk("COMPAT "); } if (port->modes&PARPORT_MODE_EPP) { printk("EPP "); }
-	if (port->modes&PARPORT_MODE_ECP) { printk("ECP "); } if (port->modes&PARPORT_MODE_DMA) { printk("DMA "); }	printk("\n");
-#endif //DEBUG
+// Report whatever changed in the state of a pad since it was last reported to its input device.
+// Returns true if there was any input, meaning a button changed or a stick moved by more than
+// its noise
+static bool psxpad_report(struct input_dev* dev, struct psx_pad* pad)
+{
+    int button_count = 0, axis_count = 0;
+    const uint16_t button_status = *((uint16_t*)pad->button_status);
+    const uint16_t changed = button_status ^ pad->reported_status;
+    bool input = changed != 0;
 
-	if (new_lintap != NULL) { //kmalloc for new structure succeeded
-		memset(new_lintap, 0, sizeof(struct lintap_device));  //Zero out new allocated structure
-		new_lintap->port_dev = parport_register_device(port, "Lintap", NULL, NULL, NULL, 0, new_lintap); //attempt to register device
-		if (new_lintap->port_dev != NULL) { //successful registration of driver with port
-			debugk("Successful registration of device\n");
-            init_psxpads(new_lintap);
-			new_lintap->next = lintap_list;
-			lintap_list = new_lintap;	//simply prepend new lintap record to existing list
-		} else {
-			debugk("Failed to register device: \n");
-			kfree(new_lintap); //free memory
-		}
+    if (changed & (PSX_LEFT | PSX_RIGHT))
+    {
+        const int abs_x = 0 + (button_status & PSX_RIGHT ? 0 : 255) - (button_status & PSX_LEFT ? 0 : 255);
+        debugk("lintap pad num: %d, axis x: %d\n", pad->pad_num, abs_x);
+        input_report_abs(dev, ABS_X, abs_x);
+    }
+    if (changed & (PSX_UP | PSX_DOWN))
+    {
+        const int abs_y = 0 + (button_status & PSX_DOWN ? 0 : 255) - (button_status & PSX_UP ? 0 : 255);
+        debugk("lintap pad num: %d, axis y: %d\n", pad->pad_num, abs_y);
+        input_report_abs(dev, ABS_Y, abs_y);
+    }
 
-	} else {
-		debugk("Error - could not allocate memory for lintap device\n");
-	}
-}
+    for (button_count = 0; button_count < MAX_BUTTONS; button_count++) {
+        if (changed & psxpad_button_masks[button_count]) {
+            input_report_key(dev, psxpad_button_events[button_count], ~button_status & psxpad_button_masks[button_count]);
+        }
+    }
 
-static void detach_from_parport(struct parport *port) {  //handle detachment from parport due to no devices being registered */
-	// TODO - This needs to be implemented for multiple parallel ports or if weird stuff happens.
-	// Should unregister the lintap device attached with the port
-	debugk("detach_from_parport() - Lintap is being detached.  No problem.\n");
-}
+    for (axis_count = 0; axis_count < MAX_AXES; axis_count++) {
+        if (pad->axes[axis_count] != pad->reported_axes[axis_count]) {
+            input_report_abs(dev, psxpad_axis_events[axis_count], pad->axes[axis_count]);
+            // Stick noise doesn't keep the port from going idle
+            if (abs(pad->axes[axis_count] - pad->reported_axes[axis_count]) > PSX_AXIS_FUZZ) { input = true; }
+        }
+    }
+    memcpy(pad->reported_axes, pad->axes, MAX_AXES);
 
-// Set up the module.  Register it as a parallel port driver with handler functions to attach
-// and detach to and from parallel ports.  Initialise timer strucure with address
-// of lintap list which will be later used to set the call back timer
-static int __init lintap_module_init(void) {
-    debugk("!!!!!!!!LINTAP INIT!!!!!\n");
-    // INITALISE TIMER FIRST BEFORE REGISTERING WITH PARPORT SO THAT IT IS READY AS SOON AS REGISTRATION IS COMPLETE
-	init_lintap_timer(&timer, &lintap_list);
-	// INITALISE TIMER FIRST BEFORE REGISTERING WITH PARPORT SO THAT IT IS READY AS SOON AS REGISTRATION IS COMPLETE
-	if (parport_register_driver(&lintap_driver)) {
-		debugk("Error registering Lintap parport driver.\n");
-	} else {
-		debugk("Lintap parport driver registered successfully.\n");
-		registered_with_parport = true;
-	}
-	return 0;
+    input_sync(dev);
+    pad->reported_status = button_status;
+    return input;
 }
 
-static void __exit lintap_module_exit(void)
+// Report whatever changed on every pad of a port to its aggregate device, with a single sync
+// for the whole poll.  Pads which have gone missing read as all released with their sticks
+// centred, so they are reported that way once.  Returns true if any pad had input, counted the
+// same way as psxpad_report
+static bool lintap_aggregate_report(struct input_dev* dev, struct lintap_device* lintap)
 {
-    // deactive timer before doing anything else!
-    disable_lintap_timer();
-    // deactive timer before doing anything else!
+    bool input = false, reported = false;
+    int pad_count, button_count, axis_count;
 
-    if (registered_with_parport) {
-		struct lintap_device* ptr_lintap = lintap_list; //get handle to start of list
-        debugk("Unregistering parport driver.\n");
+    for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+    {
+        struct psx_pad* pad = &lintap->pads[pad_count];
+        const uint16_t button_status = *((uint16_t*)pad->button_status);
+        const uint16_t changed = button_status ^ pad->reported_status;
 
-        // Loop through each lintap structure.  Release the parallel port it has claimed
-        // and unregister all the pad devices it was responsible for.
-        // Finally, release the kernel memory for the Lintap structure.
-		while (ptr_lintap != NULL)
+        if (!pad->present && pad->missed_probes < PAD_MISSED_PROBES) { lintap->stats.pad_errors[pad_count]++; }
+        if (changed == 0 && memcmp(pad->axes, pad->reported_axes, MAX_AXES) == 0) { continue; }
+
+        if (changed & (PSX_LEFT | PSX_RIGHT))
+        {
+            input_report_abs(dev, ABS_HAT0X + pad_count * 2, (button_status & PSX_RIGHT ? 0 : 1) - (button_status & PSX_LEFT ? 0 : 1));
+        }
+        if (changed & (PSX_UP | PSX_DOWN))
+        {
+            input_report_abs(dev, ABS_HAT0Y + pad_count * 2, (button_status & PSX_DOWN ? 0 : 1) - (button_status & PSX_UP ? 0 : 1));
+        }
+        for (button_count = 0; button_count < MAX_BUTTONS; button_count++)
         {
-            int pad_count = 0;
-			struct lintap_device* temp_lintap = ptr_lintap->next;
-			if (ptr_lintap->port_claimed) {	lintap_release_port(ptr_lintap); }
-            // Unregister each pad device
-   			for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+            if (changed & psxpad_button_masks[button_count])
             {
-                struct input_dev* dev = ptr_lintap->pads[pad_count].dev;
-				if (dev != NULL) { input_unregister_device(dev); }
+                input_report_key(dev, lintap_aggregate_button(pad_count, button_count), ~button_status & psxpad_button_masks[button_count]);
             }
-			debugk("Unregistering device: %s\n", ptr_lintap->port_dev->name);
-			parport_unregister_device(ptr_lintap->port_dev);
-            kfree(ptr_lintap);  //free lintap and pads memory
-			ptr_lintap = temp_lintap; //On to the next pointer on the list
-		}
+        }
+        for (axis_count = 0; axis_count < MAX_AXES; axis_count++)
+        {
+            if (pad->axes[axis_count] != pad->reported_axes[axis_count])
+            {
+                input_report_abs(dev, aggregate_axis_events[pad_count][axis_count], pad->axes[axis_count]);
+                if (abs(pad->axes[axis_count] - pad->reported_axes[axis_count]) > PSX_AXIS_FUZZ) { input = true; }
+            }
+        }
+        memcpy(pad->reported_axes, pad->axes, MAX_AXES);
+        trace_lintap_report(lintap->port_dev->port->name, pad_count, pad->pad_id, button_status, changed);
+        pad->reported_status = button_status;
+        if (changed != 0) { input = true; }
+        reported = true;
+    }
 
-        // unregister driver from kernel
-		parport_unregister_driver(&lintap_driver);
-		registered_with_parport = false;
-		debugk("Destroying Lintap Timer\n");
-		destroy_timer_on_stack(&timer);
-	} else {
-		debugk("Driver is not registered, module exiting.\n");
+    if (reported) { input_sync(dev); }
+    return input;
+}
+
+// Start of a poll of a port, which was due at scheduled.  Counts it in the statistics, and
+// returns the time it started
+static ktime_t lintap_poll_begin(struct lintap_device* lintap, ktime_t scheduled)
+{
+    const ktime_t now = ktime_get();
+    const s64 lateness = ktime_to_ns(ktime_sub(now, scheduled));
+
+    trace_lintap_poll_start(lintap->port_dev->port->name, lateness);
+    lintap->stats.polls++;
+    lintap->stats.lateness_ns_total += max_t(s64, lateness, 0);
+    lintap->stats.lateness_ns_max = max_t(u64, lintap->stats.lateness_ns_max, max_t(s64, lateness, 0));
+    if (ktime_to_ns(lintap->stats.last_poll) != 0) { lintap_stats_histogram(lintap->stats.interval_histogram, ktime_to_ns(ktime_sub(now, lintap->stats.last_poll))); }
+    lintap->stats.last_poll = now;
+    return now;
+}
+
+// Report the state of the pads just read, from a poll which started at now, to the ring and
+// the input devices.  Only buttons and axes which changed since the last report generate
+// events, and pads with nothing changed are skipped altogether, so idle pads cost no input
+// events or wakeups.  A pad which has gone missing reads as all buttons released, which is
+// reported once so nothing is left held down, with its sticks centred, and after that it is
+// skipped until it answers again.  Input devices are looked up under RCU, as the probe work
+// may be removing them.  In aggregate mode all the pads go to the port's one device instead.
+static void lintap_poll_report(struct lintap_device* lintap, ktime_t now)
+{
+    int pad_count = 0;
+    struct input_dev* aggregate_dev;
+
+    if (lintap->ring != NULL) { lintap_ring_write(lintap, now); }
+    rcu_read_lock();
+    aggregate_dev = rcu_dereference(lintap->aggregate_dev);
+    if (aggregate_dev != NULL)
+    {
+        if (lintap_aggregate_report(aggregate_dev, lintap)) { lintap->last_input_ns = ktime_to_ns(now); }
+        rcu_read_unlock();
+        return;
+    }
+    for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+    {
+        struct psx_pad* pad = &lintap->pads[pad_count];   //get handle to current pad
+        struct input_dev* dev = rcu_dereference(pad->dev);	//get pointer to device structure
+        uint16_t button_status, changed;
+
+        // Slots without a registered device are left to the probe work
+        if (dev == NULL) { continue; }
+        if (!pad->present) { lintap->stats.pad_errors[pad_count]++; }
+
+        button_status = *((uint16_t*)pad->button_status);
+        changed = button_status ^ pad->reported_status;
+        if (changed == 0 && memcmp(pad->axes, pad->reported_axes, MAX_AXES) == 0) { continue; }
+
+        if (psxpad_report(dev, pad)) { lintap->last_input_ns = ktime_to_ns(now); }
+        trace_lintap_report(lintap->port_dev->port->name, pad_count, pad->pad_id, button_status, changed);
+    }
+    rcu_read_unlock();
+}
+
+// Read all pads on a claimed port and report their state.  Scheduled is the time the poll was
+// due, for the statistics.  As LINTAP_IOC_POLL_NOW can poll the port outside the poller, the
+// whole poll owns the bus busy bit, like a transaction on the timer engine.  A lock would keep
+// preemption or softirqs off for the whole busy wait.  Returns false without polling if another
+// poll has the bus, in which case its frame is as fresh as this one would have been
+static bool lintap_poll_port(struct lintap_device* lintap, ktime_t scheduled)
+{
+    ktime_t now;
+
+    if (test_and_set_bit_lock(0, &lintap->bus_busy)) { return false; }
+    now = lintap_poll_begin(lintap, scheduled);
+    psxpads_read_status(lintap, true); //get status from pad
+    lintap_poll_report(lintap, now);
+    clear_bit_unlock(0, &lintap->bus_busy);
+    wake_up(&lintap->bus_wait);
+    return true;
+}
+
+/* Timer engine.  Clocks a poll with one high resolution timer event per clock edge, releasing
+   the CPU in between, instead of busy waiting through the whole transaction.  The edges and
+   phase timings are the same as psxpads_capture, except that the gap after each byte is always
+   the byte gap as there is no busy waiting for acknowledges.  Each event is due a phase timing
+   after the edge made by the one before, so timer latency and port accesses only ever lengthen
+   a phase, and the timings are the least spacing of the edges rather than the real one.  Polls
+   are reported from the timer event which ends the transaction. */
+
+// Start a poll on the timer engine.  Select is raised on all pads straight away, and the rest of
+// the transaction is clocked by the engine timer.  Returns false if a transaction is still running.
+// If generation isn't NULL, it is set to the number of the transaction started
+static bool lintap_engine_start(struct lintap_device* lintap, ktime_t scheduled, unsigned int* generation)
+{
+	struct lintap_engine* engine = &lintap->engine;
+
+	if (test_and_set_bit_lock(0, &engine->busy)) { return false; }
+
+	engine->poll_start = lintap_poll_begin(lintap, scheduled);
+	engine->direct = ACCESS_ONCE(lintap->transfer_path) == TRANSFER_PATH_DIRECT;
+	engine->state = ENGINE_ATTENTION;
+	engine->byte_count = 0;
+	engine->bit_count = 0;
+	engine->length = PSX_MAX_TRANSFER_BYTES;
+	memset(engine->samples, 0xFF, sizeof(engine->samples));
+	engine->started++;
+	if (generation != NULL) { *generation = engine->started; }
+
+	// send select high to all pads, then lower select edge on the first timer event
+	lintap_write_data(lintap, engine->direct, PSX_CLOCK|PSX_SELECT_ALL);
+	hrtimer_start(&engine->timer, ns_to_ktime(ACCESS_ONCE(lintap->timing_ns[PHASE_SELECT_SETUP])), HRTIMER_MODE_REL);
+	return true;
+}
+
+// End of a transaction on the timer engine.  Decodes and reports it, then lets the next one start
+static void lintap_engine_finish(struct lintap_device* lintap)
+{
+	struct lintap_engine* engine = &lintap->engine;
+
+	trace_lintap_deselect(lintap->port_dev->port->name, engine->byte_count);
+	lintap_transfer_stats(lintap, ktime_to_ns(ktime_sub(ktime_get(), engine->poll_start)));
+	psxpads_store_status(lintap->pads, engine->samples, engine->byte_count);
+	lintap_capture_write(lintap, engine->poll_start, engine->samples, engine->byte_count);
+	lintap_poll_report(lintap, engine->poll_start);
+
+	engine->finished = engine->started;
+	clear_bit_unlock(0, &engine->busy);
+	wake_up(&engine->wait);
+}
+
+// Engine timer event.  Makes one clock edge of the transaction, then sets the timer for the next
+static enum hrtimer_restart lintap_engine_func(struct hrtimer* hrtimer)
+{
+	struct lintap_engine* engine = container_of(hrtimer, struct lintap_engine, timer);
+	struct lintap_device* lintap = container_of(engine, struct lintap_device, engine);
+	unsigned int delay;
+	uint8_t command_bit;
+
+	switch (engine->state)
+	{
+		case ENGINE_ATTENTION:
+			// set selected pad low and clock high and command high
+			lintap_write_data(lintap, engine->direct, PSX_CLOCK);
+			trace_lintap_select(lintap->port_dev->port->name);
+			engine->state = ENGINE_CLOCK_LOW;
+			delay = ACCESS_ONCE(lintap->timing_ns[PHASE_SELECT_SETUP]);
+			break;
+		case ENGINE_CLOCK_LOW:
+			command_bit = (psx_status_commands[engine->byte_count] >> engine->bit_count) & 0x01;
+			lintap_write_data(lintap, engine->direct, command_bit);	//clock low with the command bit
+			engine->state = ENGINE_CLOCK_HIGH;
+			delay = ACCESS_ONCE(lintap->timing_ns[PHASE_CLOCK_LOW]);
+			break;
+		case ENGINE_CLOCK_HIGH:
+			command_bit = (psx_status_commands[engine->byte_count] >> engine->bit_count) & 0x01;
+			engine->samples[engine->byte_count][engine->bit_count] = lintap_read_status(lintap, engine->direct);
+			lintap_write_data(lintap, engine->direct, command_bit | PSX_CLOCK);	//set clock high
+			engine->state = ENGINE_CLOCK_LOW;
+			delay = ACCESS_ONCE(lintap->timing_ns[PHASE_CLOCK_HIGH]);
+			if (++engine->bit_count == 8)
+			{
+				trace_lintap_byte(lintap->port_dev->port->name, engine->byte_count, psx_status_commands[engine->byte_count],
+					engine->samples[engine->byte_count]);
+				if (engine->byte_count == PSX_BYTE_ID) { engine->length = psxpads_transfer_length(engine->samples[PSX_BYTE_ID]); }
+				engine->bit_count = 0;
+				engine->byte_count++;
+				delay += ACCESS_ONCE(lintap->timing_ns[PHASE_BYTE_GAP]);	//gap after each byte
+				if (engine->byte_count == engine->length) { engine->state = ENGINE_DESELECT; }
+			}
+			break;
+		default:
+			psxpads_deselect(lintap, engine->direct);
+			lintap_engine_finish(lintap);
+			return HRTIMER_NORESTART;
+	}
+
+	// Due from the edge just made rather than the last expiry, so latency can't shorten the phase
+	hrtimer_set_expires(hrtimer, ktime_add_ns(ktime_get(), delay));
+	return HRTIMER_RESTART;
+}
+
+// Wait for any transaction running on the timer engine to finish
+static void lintap_engine_idle(struct lintap_device* lintap)
+{
+	wait_event(lintap->engine.wait, !test_bit(0, &lintap->engine.busy));
+}
+
+// Poll the port on the timer engine from process context, and wait for the poll to finish.
+// The CPU is free for anything else while the transaction is being clocked
+static void lintap_engine_poll(struct lintap_device* lintap, ktime_t scheduled)
+{
+	unsigned int generation;
+
+	while (!lintap_engine_start(lintap, scheduled, &generation)) { lintap_engine_idle(lintap); }
+	wait_event(lintap->engine.wait, (int)(ACCESS_ONCE(lintap->engine.finished) - generation) >= 0);
+}
+
+static void lintap_engine_init(struct lintap_device* lintap)
+{
+	hrtimer_init(&lintap->engine.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	lintap->engine.timer.function = lintap_engine_func;
+	init_waitqueue_head(&lintap->engine.wait);
+}
+
+static void lintap_poll_tasklet_func(unsigned long private) {
+    struct lintap_device* lintap = (struct lintap_device*)private;
+
+    debugk("Timer running\n");
+    lintap_measure_poll(lintap, lintap_port_idle(lintap, ktime_get()));
+    lintap_poll_port(lintap, ns_to_ktime(ACCESS_ONCE(lintap->poll_scheduled_ns)));
+}
+
+// Timer event.  Hands the poll over to the tasklet so the busy waiting doesn't happen in
+// hard interrupt context, or starts it on the timer engine, then moves the expiry on by whole poll periods from the previous
+// expiry rather than from now, so that time taken to service the timer does not accumulate.
+// Periods missed entirely are skipped instead of being polled in a burst
+static enum hrtimer_restart lintap_timer_func(struct hrtimer* hrtimer) {
+    struct lintap_device* lintap = container_of(hrtimer, struct lintap_device, timer);
+
+    if (!lintap_poll_skip(lintap, ktime_get()))
+    {
+        // The engine clocks the poll itself.  If the last poll is still running, this one is skipped
+        if (lintap->use_engine)
+        {
+            if (lintap_engine_start(lintap, hrtimer_get_expires(hrtimer), NULL)) { lintap_measure_poll(lintap, lintap_port_idle(lintap, ktime_get())); }
+        }
+        else
+        {
+            lintap->poll_scheduled_ns = ktime_to_ns(hrtimer_get_expires(hrtimer));
+            tasklet_hi_schedule(&lintap->poll_tasklet);
+        }
+    }
+    hrtimer_forward_now(hrtimer, ns_to_ktime(lintap_poll_period()));
+    return HRTIMER_RESTART; //reactivate timer function
+}
+
+// Polling thread main loop.  Does the same work as the timer function, but in process context
+// so the busy waiting on the parallel port can be kept off the CPUs running everything else.
+// Polls are scheduled against absolute times so time spent polling does not stretch the period.
+static int lintap_poll_thread_func(void* private)
+{
+    struct lintap_device* lintap = (struct lintap_device*)private;
+    ktime_t next_poll = ktime_get();
+
+    while (!kthread_should_stop())
+    {
+        ktime_t now = ktime_get();
+
+        if (!lintap_poll_skip(lintap, now))
+        {
+            debugk("Poll thread running\n");
+            lintap_measure_poll(lintap, lintap_port_idle(lintap, now));
+            if (lintap->use_engine) { lintap_engine_poll(lintap, next_poll); }
+            else { lintap_poll_port(lintap, next_poll); }
+        }
+
+        next_poll = ktime_add_ns(next_poll, lintap_poll_period());
+        now = ktime_get();
+        // If the thread has fallen behind, start again from now rather than polling in a burst
+        if (ktime_to_ns(ktime_sub(next_poll, now)) <= 0) { next_poll = ktime_add_ns(now, lintap_poll_period()); }
+
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop()) { schedule_hrtimeout(&next_poll, HRTIMER_MODE_ABS); }
+        __set_current_state(TASK_RUNNING);
+    }
+
+    return 0;
+}
+
+// Create the polling thread for a port, bind it to the CPU requested for the port number and
+// give it real time priority.  Returns false if the thread could not be created
+static bool enable_lintap_poll_thread(struct lintap_device* lintap)
+{
+    const struct parport* port = lintap->port_dev->port;
+    const int cpu = port->number < PARPORT_MAX ? poll_cpu[port->number] : -1;
+    struct task_struct* task = kthread_create(lintap_poll_thread_func, lintap, "lintap/%s", port->name);
+
+    if (IS_ERR(task)) { return false; }
+
+    if (cpu >= 0)
+    {
+        if (cpu < nr_cpu_ids && cpu_online(cpu)) { kthread_bind(task, cpu); }
+        else { printk(KERN_WARNING "lintap: CPU %d is not online, polling thread for %s not bound\n", cpu, port->name); }
+    }
+
+    if (poll_priority > 0)
+    {
+        struct sched_param param = { .sched_priority = min(poll_priority, MAX_RT_PRIO - 1) };
+        sched_setscheduler(task, SCHED_FIFO, &param);
+    }
+
+    lintap->poll_task = task;
+    wake_up_process(task);
+    debugk("Activating polling thread for %s\n", port->name);
+    return true;
+}
+
+static void disable_lintap_poll_thread(struct lintap_device* lintap)
+{
+    kthread_stop(lintap->poll_task);
+    lintap->poll_task = NULL;
+    debugk("Polling thread stopped for %s\n", lintap->port_dev->port->name);
+}
+
+// Start polling a claimed port, either from its polling thread or its timer.
+// Falls back to the timer if the thread can't be created
+static void start_lintap_polling(struct lintap_device* lintap)
+{
+    // Set active flag first before starting, so that flag is set before the poller runs
+    lintap->polling_active = true;
+    lintap->last_poll_ns = 0;
+    lintap->last_input_ns = ktime_to_ns(ktime_get());	//start at the full rate
+    if (!poll_thread || !enable_lintap_poll_thread(lintap)) { enable_lintap_timer(lintap); }
+}
+
+static void stop_lintap_polling(struct lintap_device* lintap)
+{
+    if (lintap->poll_task != NULL) { disable_lintap_poll_thread(lintap); }
+    else { disable_lintap_timer(lintap); }
+    // Clear active flag after stopping, so that flag truly reflects poller state
+    lintap->polling_active = false;
+}
+
+static void init_psxpads(struct lintap_device *lintap) {
+	int pad_count;
+
+	for (pad_count = 0; pad_count<MAX_PADS; pad_count++) {
+		struct psx_pad *new_pad = &lintap->pads[pad_count];
+
+		if (new_pad) {
+			memset(new_pad, 0, sizeof(struct psx_pad));
+			new_pad->lintap = lintap;	//make the pad belong to the current lintap
+			new_pad->pad_num = pad_count;
+			new_pad->missed_probes = PAD_MISSED_PROBES;	//not connected until a probe finds it
+			new_pad->reported_status = PSX_BUTTONS_RELEASED;
+			*((uint16_t*)new_pad->button_status) = PSX_BUTTONS_RELEASED;
+			memset(new_pad->axes, PSX_AXIS_CENTRE, MAX_AXES);
+			memset(new_pad->reported_axes, PSX_AXIS_CENTRE, MAX_AXES);
+        }
+	}
+}
+
+// Returns a bit for each pad which answered the last transaction with a valid ID and status
+static unsigned int psxpads_present_mask(const struct lintap_device* lintap)
+{
+	unsigned int mask = 0;
+	int pad_count;
+
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+	{
+		if (lintap->pads[pad_count].present) { mask |= 1 << pad_count; }
+	}
+	return mask;
+}
+
+// Returns true if calibrate_rounds transactions with the port's current delays all find
+// exactly the pads in expected_mask, each with a valid ID and status
+static bool lintap_calibrate_check(struct lintap_device* lintap, unsigned int expected_mask)
+{
+	unsigned int round;
+
+	for (round = 0; round < calibrate_rounds; round++)
+	{
+		psxpads_read_status(lintap, false);
+		if (psxpads_present_mask(lintap) != expected_mask) { return false; }
+	}
+	return true;
+}
+
+// Find the smallest timing for one phase, to within CALIBRATE_STEP_NS, which still gives the
+// expected pads.  The phase's current timing is known to work, and is the top of the search
+static void lintap_calibrate_phase(struct lintap_device* lintap, enum lintap_phase phase, unsigned int expected_mask)
+{
+	unsigned int low = 0, high = lintap->timing_ns[phase];
+
+	while (high - low > CALIBRATE_STEP_NS)
+	{
+		const unsigned int middle = low + (high - low) / 2;
+
+		lintap->timing_ns[phase] = middle;
+		if (lintap_calibrate_check(lintap, expected_mask)) { high = middle; }
+		else { low = middle; }
+	}
+	lintap->timing_ns[phase] = high;
+}
+
+// Find the smallest timing for each phase which still gives consistent valid responses from
+// the connected pads, then add calibrate_margin percent on top for safety.  The port's current
+// timings are the starting point and the upper limit of the search, and are kept if they fail.
+// The cost of port accesses is measured again first, so the timings found are real edge spacings.
+// In handshake mode the byte gap is left alone, as the acknowledge is waited for in its place and
+// any gap would pass.  Must be called with the lock held and the port not claimed for polling, so nothing else is
+// using the bus.  The port is claimed for the duration of the calibration.
+static int lintap_calibrate(struct lintap_device* lintap)
+{
+	unsigned int old_timing[PHASES];
+	unsigned int expected_mask;
+	int phase, ret = 0;
+	bool handshake;
+
+	if (lintap->detached) { return -ENODEV; }
+	if (lintap->port_claimed) { return -EBUSY; }
+	if (parport_claim(lintap->port_dev) != 0) { return -EBUSY; }
+
+	handshake = ACCESS_ONCE(ack_handshake);
+	memcpy(old_timing, lintap->timing_ns, sizeof(old_timing));
+	lintap_measure_io(lintap);
+	// Pads found at the current timings are the reference every other setting must match
+	psxpads_read_status(lintap, false);
+	expected_mask = psxpads_present_mask(lintap);
+	if (expected_mask == 0) { ret = -ENODEV; }
+	else if (!lintap_calibrate_check(lintap, expected_mask)) { ret = -EIO; }
+	else
+	{
+		for (phase = 0; phase < PHASES; phase++)
+		{
+			if (phase != PHASE_BYTE_GAP || !handshake) { lintap_calibrate_phase(lintap, phase, expected_mask); }
+		}
+		for (phase = 0; phase < PHASES; phase++)
+		{
+			const unsigned int timing = lintap->timing_ns[phase];
+			lintap->timing_ns[phase] = min(timing + DIV_ROUND_UP(timing * calibrate_margin, 100), old_timing[phase]);
+		}
+		// The margin is worked out from separate searches, so make sure the combination works too
+		if (!lintap_calibrate_check(lintap, expected_mask)) { ret = -EIO; }
+	}
+
+	if (ret != 0) { memcpy(lintap->timing_ns, old_timing, sizeof(old_timing)); }
+	parport_release(lintap->port_dev);
+	lintap->calibrated = true;
+	printk(KERN_INFO "lintap: %s calibration %s, %s %u ns, %s %u ns, %s %u ns, %s %u ns, port access %u ns\n", lintap->port_dev->port->name,
+		ret == 0 ? "succeeded" : "failed", phase_names[PHASE_SELECT_SETUP], lintap->timing_ns[PHASE_SELECT_SETUP],
+		phase_names[PHASE_CLOCK_LOW], lintap->timing_ns[PHASE_CLOCK_LOW], phase_names[PHASE_CLOCK_HIGH], lintap->timing_ns[PHASE_CLOCK_HIGH],
+		phase_names[PHASE_BYTE_GAP], lintap->timing_ns[PHASE_BYTE_GAP], lintap->io_ns[lintap->transfer_path]);
+	return ret;
+}
+
+// Checks for pads being connected or disconnected, and registers or unregisters their input
+// devices to match, so that only slots with a pad in them have a device.  While pads are in use
+// the poller keeps the presence of every slot up to date, otherwise the port is claimed just long
+// enough to read the pads once.  A pad has to be missing for PAD_MISSED_PROBES probes in a row
+// before it is removed, so that a single bad read doesn't take a device away from its users.
+// Input devices are only registered and unregistered here, outside the lock, because doing so
+// can open or close the device and call back into psxpad_open/psxpad_close.
+static void lintap_probe_work_func(struct work_struct* work)
+{
+	struct lintap_device* lintap = container_of(to_delayed_work(work), struct lintap_device, probe_work);
+	int pad_count;
+
+	mutex_lock(&lintap->lock);
+	if (!lintap->port_claimed && parport_claim(lintap->port_dev) == 0)
+	{
+		psxpads_read_status(lintap, false);
+		parport_release(lintap->port_dev);
+		// Calibrate the first time there are pads to calibrate against
+		if (!lintap->calibrated && psxpads_present_mask(lintap) != 0) { lintap_calibrate(lintap); }
+	}
+	mutex_unlock(&lintap->lock);
+
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+	{
+		struct psx_pad* pad = &lintap->pads[pad_count];
+		bool registered = rcu_access_pointer(pad->dev) != NULL;
+
+		if (pad->present)
+		{
+			pad->missed_probes = 0;
+			if (!registered && rcu_access_pointer(lintap->aggregate_dev) == NULL)
+			{
+				debugk("Pad %d connected on %s\n", pad_count, lintap->port_dev->port->name);
+				register_psxpad_device(pad);
+			}
+		}
+		// Pads only count as disconnected after PAD_MISSED_PROBES probes, whether or not they have a device
+		else if (pad->missed_probes < PAD_MISSED_PROBES && ++pad->missed_probes == PAD_MISSED_PROBES && registered)
+		{
+			debugk("Pad %d disconnected from %s\n", pad_count, lintap->port_dev->port->name);
+			unregister_psxpad_device(pad);
+		}
+	}
+
+	schedule_delayed_work(&lintap->probe_work, msecs_to_jiffies(ACCESS_ONCE(probe_interval)));
+}
+
+// Create the timer of a port, and the tasklet it schedules to poll the port
+static void init_lintap_timer(struct lintap_device* lintap)
+{
+    hrtimer_init(&lintap->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    lintap->timer.function = lintap_timer_func;
+    tasklet_init(&lintap->poll_tasklet, lintap_poll_tasklet_func, (unsigned long)lintap);
+}
+
+
+/* Per port statistics in debugfs, in /sys/kernel/debug/lintap/<port name> */
+
+// Prints a log2 histogram, one line for each bucket with its range in nsecs
+static int lintap_histogram_show(struct seq_file* seq, void* unused)
+{
+	const u32* histogram = (const u32*)seq->private;
+	int bucket;
+
+	for (bucket = 0; bucket < STATS_HISTOGRAM_BUCKETS; bucket++)
+	{
+		const u64 low = bucket == 0 ? 0 : 1ULL << (bucket - 1);
+		seq_printf(seq, "%10llu - %10llu: %u\n", low, (1ULL << bucket) - 1, histogram[bucket]);
+	}
+	return 0;
+}
+
+static int lintap_histogram_open(struct inode* inode, struct file* file)
+{
+	return single_open(file, lintap_histogram_show, inode->i_private);
+}
+
+static const struct file_operations lintap_histogram_fops = {
+	.owner = THIS_MODULE,
+	.open = lintap_histogram_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+// Writing anything clears all the statistics for the port
+static ssize_t lintap_stats_reset_write(struct file* file, const char __user* buf, size_t count, loff_t* ppos)
+{
+	struct lintap_device* lintap = (struct lintap_device*)file->private_data;
+
+	memset(&lintap->stats, 0, sizeof(struct lintap_stats));
+	return count;
+}
+
+static const struct file_operations lintap_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = lintap_stats_reset_write,
+	.llseek = noop_llseek,
+};
+
+// Time taken by the rounds of one benchmark
+struct lintap_bench_result {
+	u64 total_ns;
+	u64 min_ns;
+	u64 max_ns;
+};
+
+static void lintap_bench_count(struct lintap_bench_result* result, ktime_t start)
+{
+	const u64 elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	result->total_ns += elapsed;
+	result->min_ns = min(result->min_ns, elapsed);
+	result->max_ns = max(result->max_ns, elapsed);
+}
+
+static void lintap_bench_print(struct seq_file* seq, const char* name, const struct lintap_bench_result* result, u32 rounds)
+{
+	seq_printf(seq, "%-12s avg %8llu ns  min %8llu ns  max %8llu ns\n", name, div_u64(result->total_ns, rounds),
+		result->min_ns, result->max_ns);
+}
+
+// Reading bench measures the stages of a poll over BENCH_ROUNDS rounds each: whole transactions
+// on the port's current transfer path, decoding a transaction, and reporting a pad with every
+// button and axis changed to a scratch input device, registered for the run and removed after it.
+// The device shows up in userspace while it is there, but lintap_scratch_handler grabs it so none
+// of its events do.  Like calibration it needs the port to itself, so fails if the pads are in
+// use.  Together with lintap_sim this allows changes to be measured without an adapter
+static int lintap_bench_show(struct seq_file* seq, void* unused)
+{
+	struct lintap_device* lintap = (struct lintap_device*)seq->private;
+	struct lintap_bench_result transfer = { 0, ULLONG_MAX, 0 }, decode = { 0, ULLONG_MAX, 0 }, emit = { 0, ULLONG_MAX, 0 };
+	uint8_t samples[PSX_MAX_TRANSFER_BYTES][8];
+	struct psx_pad pad;
+	struct input_dev* dev;
+	int round, length = 0, ret = 0;
+
+	mutex_lock(&lintap->lock);
+	if (lintap->detached) { ret = -ENODEV; }
+	else if (lintap->port_claimed || parport_claim(lintap->port_dev) != 0) { ret = -EBUSY; }
+	else
+	{
+		lintap_measure_io(lintap);
+		for (round = 0; round < BENCH_ROUNDS; round++)
+		{
+			const ktime_t start = ktime_get();
+
+			if (lintap->transfer_path == TRANSFER_PATH_DIRECT) { length = psxpads_capture_direct(lintap, samples); }
+			else { length = psxpads_capture_generic(lintap, samples); }
+			lintap_bench_count(&transfer, start);
+		}
+		parport_release(lintap->port_dev);
+
+		for (round = 0; round < BENCH_ROUNDS; round++)
+		{
+			const ktime_t start = ktime_get();
+
+			psxpads_store_status(lintap->pads, samples, length);
+			lintap_bench_count(&decode, start);
+		}
+	}
+	mutex_unlock(&lintap->lock);
+	if (ret != 0) { return ret; }
+
+	memset(&pad, 0, sizeof(struct psx_pad));
+	dev = register_scratch_device(&pad);
+	if (dev == NULL) { return -ENOMEM; }
+	pad.reported_status = PSX_BUTTONS_RELEASED;
+	memset(pad.reported_axes, PSX_AXIS_CENTRE, MAX_AXES);
+	for (round = 0; round < BENCH_ROUNDS; round++)
+	{
+		ktime_t start;
+
+		// Alternate between everything pressed and everything released, sticks at opposite ends
+		*((uint16_t*)pad.button_status) = round & 1 ? PSX_BUTTONS_RELEASED : 0;
+		memset(pad.axes, round & 1 ? 0xFF : 0x00, MAX_AXES);
+		start = ktime_get();
+		psxpad_report(dev, &pad);
+		lintap_bench_count(&emit, start);
+	}
+	input_unregister_device(dev);
+
+	seq_printf(seq, "%d rounds, %d byte transactions on the %s transfer path\n", BENCH_ROUNDS, length, transfer_path_names[lintap->transfer_path]);
+	lintap_bench_print(seq, "transaction", &transfer, BENCH_ROUNDS);
+	lintap_bench_print(seq, "decode", &decode, BENCH_ROUNDS);
+	lintap_bench_print(seq, "emit", &emit, BENCH_ROUNDS);
+	return 0;
+}
+
+static int lintap_bench_open(struct inode* inode, struct file* file)
+{
+	return single_open(file, lintap_bench_show, inode->i_private);
+}
+
+static const struct file_operations lintap_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = lintap_bench_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+// Recording of transactions pauses while the capture is open, so it can be read in one piece
+static int lintap_capture_open(struct inode* inode, struct file* file)
+{
+	struct lintap_device* lintap = (struct lintap_device*)inode->i_private;
+
+	spin_lock_irq(&lintap->capture_lock);
+	lintap->capture_readers++;
+	spin_unlock_irq(&lintap->capture_lock);
+	file->private_data = lintap;
+	return 0;
+}
+
+static int lintap_capture_release(struct inode* inode, struct file* file)
+{
+	struct lintap_device* lintap = (struct lintap_device*)file->private_data;
+
+	spin_lock_irq(&lintap->capture_lock);
+	lintap->capture_readers--;
+	spin_unlock_irq(&lintap->capture_lock);
+	return 0;
+}
+
+// Reading the capture gives the records it holds as lintap_capture_records, oldest first
+static ssize_t lintap_capture_read(struct file* file, char __user* buf, size_t count, loff_t* ppos)
+{
+	const struct lintap_device* lintap = (const struct lintap_device*)file->private_data;
+	const u64 first = lintap->capture_head > CAPTURE_RECORDS ? lintap->capture_head - CAPTURE_RECORDS : 0;
+	const loff_t size = (loff_t)(lintap->capture_head - first) * sizeof(struct lintap_capture_record);
+	size_t copied = 0;
+
+	if (*ppos >= size) { return 0; }
+	count = min_t(loff_t, count, size - *ppos);
+	while (copied < count)
+	{
+		// Records are copied one at a time, as the oldest may be anywhere in the buffer
+		const u64 index = first + div_u64(*ppos, sizeof(struct lintap_capture_record));
+		const size_t offset = *ppos - (index - first) * sizeof(struct lintap_capture_record);
+		const size_t chunk = min(count - copied, sizeof(struct lintap_capture_record) - offset);
+		const char* record = (const char*)&lintap->capture[index % CAPTURE_RECORDS];
+
+		if (copy_to_user(buf + copied, record + offset, chunk) != 0) { return copied != 0 ? copied : -EFAULT; }
+		copied += chunk;
+		*ppos += chunk;
+	}
+	return copied;
+}
+
+static const struct file_operations lintap_capture_fops = {
+	.owner = THIS_MODULE,
+	.open = lintap_capture_open,
+	.read = lintap_capture_read,
+	.llseek = no_llseek,
+	.release = lintap_capture_release,
+};
+
+// Reading replay decodes each record written to it as a transaction, and reports the pads to
+// scratch input devices registered for the replay, as fast as it can.  Like the benchmark's, they
+// are grabbed by lintap_scratch_handler, so the replayed input never reaches userspace.  Decoding
+// and reporting are timed, and pads which decode differently from the record are counted, so
+// changes to the decoding can be checked against captures from the field.  The port itself isn't touched
+static int lintap_replay_show(struct seq_file* seq, void* unused)
+{
+	struct lintap_device* lintap = (struct lintap_device*)seq->private;
+	struct lintap_bench_result decode = { 0, ULLONG_MAX, 0 }, emit = { 0, ULLONG_MAX, 0 };
+	struct psx_pad pads[MAX_PADS];
+	struct input_dev* devs[MAX_PADS] = { NULL };
+	struct lintap_pad_frame frames[MAX_PADS];
+	u32 records, count, replayed = 0, invalid = 0, mismatches = 0;
+	int pad_count, ret = 0;
+
+	memset(pads, 0, sizeof(pads));
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+	{
+		pads[pad_count].pad_num = pad_count;
+		pads[pad_count].reported_status = PSX_BUTTONS_RELEASED;
+		memset(pads[pad_count].reported_axes, PSX_AXIS_CENTRE, MAX_AXES);
+		devs[pad_count] = register_scratch_device(&pads[pad_count]);
+		if (devs[pad_count] == NULL) { ret = -ENOMEM; goto out; }
+	}
+
+	mutex_lock(&lintap->replay_lock);
+	records = lintap->replay_bytes / sizeof(struct lintap_capture_record);
+	for (count = 0; count < records; count++)
+	{
+		const struct lintap_capture_record* record = &lintap->replay[count];
+		ktime_t start;
+
+		if (record->length > PSX_MAX_TRANSFER_BYTES) { invalid++; continue; }
+		start = ktime_get();
+		psxpads_store_status(pads, record->samples, record->length);
+		lintap_bench_count(&decode, start);
+
+		// Report the same way as lintap_poll_report, skipping pads with nothing changed
+		start = ktime_get();
+		for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+		{
+			struct psx_pad* pad = &pads[pad_count];
+
+			if (*((uint16_t*)pad->button_status) == pad->reported_status && memcmp(pad->axes, pad->reported_axes, MAX_AXES) == 0) { continue; }
+			psxpad_report(devs[pad_count], pad);
+		}
+		lintap_bench_count(&emit, start);
+
+		if (psxpads_store_frame(pads, frames) != record->present_mask || memcmp(frames, record->pads, sizeof(frames)) != 0) { mismatches++; }
+		replayed++;
+	}
+	mutex_unlock(&lintap->replay_lock);
+
+	seq_printf(seq, "%u records replayed, %u invalid, %u decoded differently from the capture\n", replayed, invalid, mismatches);
+	if (replayed != 0)
+	{
+		lintap_bench_print(seq, "decode", &decode, replayed);
+		lintap_bench_print(seq, "emit", &emit, replayed);
+		seq_printf(seq, "%llu records per second\n", div64_u64((u64)replayed * NSEC_PER_SEC, max_t(u64, decode.total_ns + emit.total_ns, 1)));
+	}
+
+out:
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+	{
+		if (devs[pad_count] != NULL) { input_unregister_device(devs[pad_count]); }
+	}
+	return ret;
+}
+
+// Opening replay for writing clears the records to replay, and opening it for reading replays them.
+// It can't be opened for both at once
+static int lintap_replay_open(struct inode* inode, struct file* file)
+{
+	struct lintap_device* lintap = (struct lintap_device*)inode->i_private;
+
+	if (!(file->f_mode & FMODE_WRITE)) { return single_open(file, lintap_replay_show, lintap); }
+	if (file->f_mode & FMODE_READ) { return -EINVAL; }
+
+	mutex_lock(&lintap->replay_lock);
+	lintap->replay_bytes = 0;
+	mutex_unlock(&lintap->replay_lock);
+	file->private_data = lintap;
+	return 0;
+}
+
+// Records can be written in pieces of any size, up to CAPTURE_RECORDS records in all
+static ssize_t lintap_replay_write(struct file* file, const char __user* buf, size_t count, loff_t* ppos)
+{
+	struct lintap_device* lintap = (struct lintap_device*)file->private_data;
+	const size_t size = CAPTURE_RECORDS * sizeof(struct lintap_capture_record);
+	ssize_t ret = count;
+
+	mutex_lock(&lintap->replay_lock);
+	if (lintap->replay == NULL) { lintap->replay = vmalloc(size); }
+	if (lintap->replay == NULL) { ret = -ENOMEM; }
+	else if (count > size - lintap->replay_bytes) { ret = -EFBIG; }
+	else if (copy_from_user((char*)lintap->replay + lintap->replay_bytes, buf, count) != 0) { ret = -EFAULT; }
+	else { lintap->replay_bytes += count; }
+	mutex_unlock(&lintap->replay_lock);
+	return ret;
+}
+
+static int lintap_replay_release(struct inode* inode, struct file* file)
+{
+	if (file->f_mode & FMODE_WRITE) { return 0; }
+	return single_release(inode, file);
+}
+
+static const struct file_operations lintap_replay_fops = {
+	.owner = THIS_MODULE,
+	.open = lintap_replay_open,
+	.read = seq_read,
+	.write = lintap_replay_write,
+	.llseek = no_llseek,
+	.release = lintap_replay_release,
+};
+
+// Create the statistics files for a port.  Statistics are only for debugging, so nothing
+// fails if debugfs isn't available
+static void lintap_debugfs_init(struct lintap_device* lintap)
+{
+	struct lintap_stats* stats = &lintap->stats;
+	char name[16];
+	int pad_count;
+
+	if (IS_ERR_OR_NULL(debugfs_root)) { return; }
+	lintap->debugfs_dir = debugfs_create_dir(lintap->port_dev->port->name, debugfs_root);
+	if (IS_ERR_OR_NULL(lintap->debugfs_dir)) { lintap->debugfs_dir = NULL; return; }
+
+	debugfs_create_u64("polls", 0444, lintap->debugfs_dir, &stats->polls);
+	debugfs_create_u64("transfers", 0444, lintap->debugfs_dir, &stats->transfers);
+	debugfs_create_u64("transfer_ns_total", 0444, lintap->debugfs_dir, &stats->transfer_ns_total);
+	debugfs_create_u64("transfer_ns_max", 0444, lintap->debugfs_dir, &stats->transfer_ns_max);
+	debugfs_create_u64("lateness_ns_total", 0444, lintap->debugfs_dir, &stats->lateness_ns_total);
+	debugfs_create_u64("lateness_ns_max", 0444, lintap->debugfs_dir, &stats->lateness_ns_max);
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+	{
+		snprintf(name, sizeof(name), "pad%d_errors", pad_count);
+		debugfs_create_u64(name, 0444, lintap->debugfs_dir, &stats->pad_errors[pad_count]);
+	}
+	debugfs_create_file("transfer_histogram", 0444, lintap->debugfs_dir, stats->transfer_histogram, &lintap_histogram_fops);
+	debugfs_create_file("interval_histogram", 0444, lintap->debugfs_dir, stats->interval_histogram, &lintap_histogram_fops);
+	debugfs_create_file("reset", 0200, lintap->debugfs_dir, lintap, &lintap_stats_reset_fops);
+	debugfs_create_file("bench", 0400, lintap->debugfs_dir, lintap, &lintap_bench_fops);
+	debugfs_create_file("replay", 0600, lintap->debugfs_dir, lintap, &lintap_replay_fops);
+	// The capture is only kept if it can be read
+	if (capture) { lintap->capture = vzalloc(CAPTURE_RECORDS * sizeof(struct lintap_capture_record)); }
+	if (lintap->capture != NULL) { debugfs_create_file("capture", 0400, lintap->debugfs_dir, lintap, &lintap_capture_fops); }
+}
+
+/* Character device for each port, /dev/lintap-<port name>, giving access to the ring of frames */
+
+// Per file state, so each reader only gets frames newer than the last one it read
+struct lintap_ring_reader {
+	struct lintap_device* lintap;
+	u64 seen;								//sequence number of the last frame read
+};
+
+// Copy the newest frame out of the ring, retrying if the poller writes a frame meanwhile.
+// Returns the sequence number of the frame
+static u64 lintap_ring_latest(const struct lintap_ring* ring, struct lintap_frame* frame)
+{
+	u32 seqcount;
+	u64 head;
+
+	do
+	{
+		seqcount = ACCESS_ONCE(ring->header.seqcount);
+		smp_rmb();
+		head = ring->header.head;
+		*frame = ring->frames[head % LINTAP_RING_FRAMES];
+		smp_rmb();
+	} while ((seqcount & 1) || seqcount != ACCESS_ONCE(ring->header.seqcount));
+
+	return head;
+}
+
+// Opening the device uses the port like opening a pad, so the port is claimed and polled
+// while it is open.  Holds a reference to the lintap device until the file is released, as
+// the port may be detached while it is still open
+static int lintap_ring_open(struct inode* inode, struct file* file)
+{
+	struct lintap_device* lintap = container_of(file->private_data, struct lintap_device, ring_dev);
+	struct lintap_ring_reader* reader = kmalloc(sizeof(struct lintap_ring_reader), GFP_KERNEL);
+	int ret = 0;
+
+	if (reader == NULL) { return -ENOMEM; }
+
+	mutex_lock(&lintap->lock);
+	if (lintap->detached) { ret = -ENODEV; }
+	else if (!lintap->port_claimed && !lintap_claim_port(lintap)) { ret = -EBUSY; }
+	else { lintap->ring_users++; }
+	mutex_unlock(&lintap->lock);
+	if (ret != 0) { kfree(reader); return ret; }
+
+	kobject_get(&lintap->kobj);
+	reader->lintap = lintap;
+	reader->seen = ACCESS_ONCE(lintap->ring->header.head);
+	file->private_data = reader;
+	return nonseekable_open(inode, file);
+}
+
+static int lintap_ring_release(struct inode* inode, struct file* file)
+{
+	struct lintap_ring_reader* reader = (struct lintap_ring_reader*)file->private_data;
+	struct lintap_device* lintap = reader->lintap;
+
+	mutex_lock(&lintap->lock);
+	lintap->ring_users--;
+	if (lintap->ring_users == 0) { lintap_put_port(lintap); }
+	mutex_unlock(&lintap->lock);
+	kfree(reader);
+	kobject_put(&lintap->kobj);
+	return 0;
+}
+
+// Returns the newest frame once there is one the file hasn't read yet
+static ssize_t lintap_ring_read(struct file* file, char __user* buf, size_t count, loff_t* ppos)
+{
+	struct lintap_ring_reader* reader = (struct lintap_ring_reader*)file->private_data;
+	struct lintap_device* lintap = reader->lintap;
+	struct lintap_frame frame;
+
+	if (count < sizeof(struct lintap_frame)) { return -EINVAL; }
+	while (ACCESS_ONCE(lintap->ring->header.head) == reader->seen)
+	{
+		if (ACCESS_ONCE(lintap->detached)) { return -ENODEV; }
+		if (file->f_flags & O_NONBLOCK) { return -EAGAIN; }
+		if (wait_event_interruptible(lintap->ring_wait,
+				ACCESS_ONCE(lintap->ring->header.head) != reader->seen || ACCESS_ONCE(lintap->detached))) { return -ERESTARTSYS; }
+	}
+
+	reader->seen = lintap_ring_latest(lintap->ring, &frame);
+	if (copy_to_user(buf, &frame, sizeof(struct lintap_frame)) != 0) { return -EFAULT; }
+	return sizeof(struct lintap_frame);
+}
+
+static unsigned int lintap_ring_poll(struct file* file, poll_table* wait)
+{
+	struct lintap_ring_reader* reader = (struct lintap_ring_reader*)file->private_data;
+	struct lintap_device* lintap = reader->lintap;
+	unsigned int mask = 0;
+
+	poll_wait(file, &lintap->ring_wait, wait);
+	if (ACCESS_ONCE(lintap->ring->header.head) != reader->seen) { mask |= POLLIN | POLLRDNORM; }
+	if (ACCESS_ONCE(lintap->detached)) { mask |= POLLHUP; }
+	return mask;
+}
+
+// LINTAP_IOC_POLL_NOW polls the port straight away, reporting to the input devices and adding a
+// frame to the ring like any other poll, and returns the newest frame.  Works whether or not the
+// port is polled periodically
+static long lintap_ring_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
+{
+	struct lintap_ring_reader* reader = (struct lintap_ring_reader*)file->private_data;
+	struct lintap_device* lintap = reader->lintap;
+	struct lintap_frame frame;
+
+	if (cmd != LINTAP_IOC_POLL_NOW) { return -ENOTTY; }
+
+	// The lock keeps the port claimed for the poll, the bus busy bit keeps the poller out
+	mutex_lock(&lintap->lock);
+	if (!lintap->port_claimed)
+	{
+		mutex_unlock(&lintap->lock);
+		return -ENODEV;
+	}
+	if (lintap->use_engine) { lintap_engine_poll(lintap, ktime_get()); }
+	else
+	{
+		while (!lintap_poll_port(lintap, ktime_get())) { wait_event(lintap->bus_wait, !test_bit(0, &lintap->bus_busy)); }
+	}
+	mutex_unlock(&lintap->lock);
+
+	reader->seen = lintap_ring_latest(lintap->ring, &frame);
+	if (copy_to_user((void __user*)arg, &frame, sizeof(struct lintap_frame)) != 0) { return -EFAULT; }
+	return 0;
+}
+
+// The ring can only be mapped read only, as only polls write to it
+static int lintap_ring_mmap(struct file* file, struct vm_area_struct* vma)
+{
+	struct lintap_ring_reader* reader = (struct lintap_ring_reader*)file->private_data;
+
+	if (vma->vm_flags & VM_WRITE) { return -EPERM; }
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, reader->lintap->ring, vma->vm_pgoff);
+}
+
+static const struct file_operations lintap_ring_fops = {
+	.owner = THIS_MODULE,
+	.open = lintap_ring_open,
+	.release = lintap_ring_release,
+	.read = lintap_ring_read,
+	.poll = lintap_ring_poll,
+	.mmap = lintap_ring_mmap,
+	.unlocked_ioctl = lintap_ring_ioctl,
+	.compat_ioctl = lintap_ring_ioctl,	//structure layout is the same for 32 bit callers
+	.llseek = no_llseek,
+};
+
+// Create the ring and character device for a port.  Pads can still be used through their input
+// devices without it, so failing only leaves the port without a character device
+static void lintap_ring_init(struct lintap_device* lintap)
+{
+	init_waitqueue_head(&lintap->ring_wait);
+	lintap->ring = (struct lintap_ring*)vmalloc_user(sizeof(struct lintap_ring));	//zeroed, and can be mapped to userspace
+	if (lintap->ring == NULL) { return; }
+	lintap->ring->header.frames = LINTAP_RING_FRAMES;
+	lintap->ring->header.frame_size = sizeof(struct lintap_frame);
+
+	snprintf(lintap->ring_name, sizeof(lintap->ring_name), "lintap-%s", lintap->port_dev->port->name);
+	lintap->ring_dev.minor = MISC_DYNAMIC_MINOR;
+	lintap->ring_dev.name = lintap->ring_name;
+	lintap->ring_dev.fops = &lintap_ring_fops;
+	if (misc_register(&lintap->ring_dev) != 0)
+	{
+		printk(KERN_WARNING "lintap: failed to create character device %s\n", lintap->ring_name);
+		vfree(lintap->ring);
+		lintap->ring = NULL;
+	}
+}
+
+/* Per port sysfs attributes, in /sys/module/lintap/<port name> */
+
+#define to_lintap_device(kobj) container_of(kobj, struct lintap_device, kobj)
+
+// bit_delay and cmd_delay are the old way of setting the timings, in usecs.  bit_delay sets the
+// select setup and both clock phases, and shows the longest of them.  cmd_delay is the byte gap
+static ssize_t bit_delay_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+	const struct lintap_device* lintap = to_lintap_device(kobj);
+	const unsigned int timing = max3(lintap->timing_ns[PHASE_SELECT_SETUP], lintap->timing_ns[PHASE_CLOCK_LOW], lintap->timing_ns[PHASE_CLOCK_HIGH]);
+
+	return sprintf(buf, "%u\n", (unsigned int)DIV_ROUND_UP(timing, NSEC_PER_USEC));
+}
+
+static ssize_t bit_delay_store(struct kobject* kobj, struct kobj_attribute* attr, const char* buf, size_t count)
+{
+	struct lintap_device* lintap = to_lintap_device(kobj);
+	unsigned short delay;
+	int ret = kstrtou16(buf, 10, &delay);
+
+	if (ret != 0) { return ret; }
+	if (delay == 0 || delay > PSX_DELAY_MAX) { return -EINVAL; }
+	ACCESS_ONCE(lintap->timing_ns[PHASE_SELECT_SETUP]) = delay * NSEC_PER_USEC;
+	ACCESS_ONCE(lintap->timing_ns[PHASE_CLOCK_LOW]) = delay * NSEC_PER_USEC;
+	ACCESS_ONCE(lintap->timing_ns[PHASE_CLOCK_HIGH]) = delay * NSEC_PER_USEC;
+	return count;
+}
+
+static ssize_t cmd_delay_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+	return sprintf(buf, "%u\n", (unsigned int)DIV_ROUND_UP(to_lintap_device(kobj)->timing_ns[PHASE_BYTE_GAP], NSEC_PER_USEC));
+}
+
+static ssize_t cmd_delay_store(struct kobject* kobj, struct kobj_attribute* attr, const char* buf, size_t count)
+{
+	unsigned short delay;
+	int ret = kstrtou16(buf, 10, &delay);
+
+	if (ret != 0) { return ret; }
+	if (delay > PSX_DELAY_MAX) { return -EINVAL; }
+	ACCESS_ONCE(to_lintap_device(kobj)->timing_ns[PHASE_BYTE_GAP]) = delay * NSEC_PER_USEC;
+	return count;
+}
+
+// Attribute for the timing of one phase, in nsecs
+struct lintap_timing_attribute {
+	struct kobj_attribute attr;
+	enum lintap_phase phase;
+};
+
+#define to_timing_attribute(kattr) container_of(kattr, struct lintap_timing_attribute, attr)
+
+static ssize_t timing_ns_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+	return sprintf(buf, "%u\n", to_lintap_device(kobj)->timing_ns[to_timing_attribute(attr)->phase]);
+}
+
+// Timings are the real spacing of the edges, so they can't be less than the port accesses in
+// the phase take, and setting them lower just runs the phase as fast as the port allows
+static ssize_t timing_ns_store(struct kobject* kobj, struct kobj_attribute* attr, const char* buf, size_t count)
+{
+	unsigned int timing;
+	int ret = kstrtouint(buf, 10, &timing);
+
+	if (ret != 0) { return ret; }
+	if (timing > PSX_DELAY_MAX * NSEC_PER_USEC) { return -EINVAL; }
+	ACCESS_ONCE(to_lintap_device(kobj)->timing_ns[to_timing_attribute(attr)->phase]) = timing;
+	return count;
+}
+
+static ssize_t io_ns_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+	const struct lintap_device* lintap = to_lintap_device(kobj);
+
+	return sprintf(buf, "%u\n", lintap->io_ns[ACCESS_ONCE(lintap->transfer_path)]);
+}
+
+static ssize_t transfer_path_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+	return sprintf(buf, "%s\n", transfer_path_names[to_lintap_device(kobj)->transfer_path]);
+}
+
+// Switch between transfer paths, so they can be compared.  Direct access needs a PC style port
+static ssize_t transfer_path_store(struct kobject* kobj, struct kobj_attribute* attr, const char* buf, size_t count)
+{
+	struct lintap_device* lintap = to_lintap_device(kobj);
+
+	if (sysfs_streq(buf, transfer_path_names[TRANSFER_PATH_GENERIC])) { ACCESS_ONCE(lintap->transfer_path) = TRANSFER_PATH_GENERIC; }
+	else if (sysfs_streq(buf, transfer_path_names[TRANSFER_PATH_DIRECT]))
+	{
+		if (lintap->io_base == 0) { return -ENODEV; }
+		ACCESS_ONCE(lintap->transfer_path) = TRANSFER_PATH_DIRECT;
+	}
+	else { return -EINVAL; }
+	return count;
+}
+
+static ssize_t transfer_ns_direct_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+	return sprintf(buf, "%u\n", to_lintap_device(kobj)->transfer_ns[TRANSFER_PATH_DIRECT]);
+}
+
+static ssize_t transfer_ns_generic_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+	return sprintf(buf, "%u\n", to_lintap_device(kobj)->transfer_ns[TRANSFER_PATH_GENERIC]);
+}
+
+static ssize_t poll_period_ns_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+	return sprintf(buf, "%u\n", to_lintap_device(kobj)->poll_period_ns);
+}
+
+static ssize_t poll_jitter_ns_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+	return sprintf(buf, "%u\n", to_lintap_device(kobj)->poll_jitter_ns);
+}
+
+static ssize_t periodic_show(struct kobject* kobj, struct kobj_attribute* attr, char* buf)
+{
+	return sprintf(buf, "%d\n", to_lintap_device(kobj)->periodic);
+}
+
+// Turning periodic polling off stops the poller of a claimed port straight away, after which
+// the port is only polled through LINTAP_IOC_POLL_NOW
+static ssize_t periodic_store(struct kobject* kobj, struct kobj_attribute* attr, const char* buf, size_t count)
+{
+	struct lintap_device* lintap = to_lintap_device(kobj);
+	bool periodic;
+	int ret = strtobool(buf, &periodic);
+
+	if (ret != 0) { return ret; }
+	mutex_lock(&lintap->lock);
+	lintap->periodic = periodic;
+	if (lintap->port_claimed && periodic && !lintap->polling_active) { start_lintap_polling(lintap); }
+	else if (!periodic && lintap->polling_active) { stop_lintap_polling(lintap); }
+	mutex_unlock(&lintap->lock);
+	return count;
+}
+
+// Writing anything runs calibration.  Fails if the pads are in use, or none are connected
+static ssize_t calibrate_store(struct kobject* kobj, struct kobj_attribute* attr, const char* buf, size_t count)
+{
+	struct lintap_device* lintap = to_lintap_device(kobj);
+	int ret;
+
+	mutex_lock(&lintap->lock);
+	ret = lintap_calibrate(lintap);
+	mutex_unlock(&lintap->lock);
+	return ret == 0 ? count : ret;
+}
+
+static struct kobj_attribute bit_delay_attribute = __ATTR(bit_delay, 0644, bit_delay_show, bit_delay_store);
+static struct kobj_attribute cmd_delay_attribute = __ATTR(cmd_delay, 0644, cmd_delay_show, cmd_delay_store);
+static struct kobj_attribute calibrate_attribute = __ATTR(calibrate, 0200, NULL, calibrate_store);
+static struct kobj_attribute transfer_path_attribute = __ATTR(transfer_path, 0644, transfer_path_show, transfer_path_store);
+static struct kobj_attribute transfer_ns_direct_attribute = __ATTR(transfer_ns_direct, 0444, transfer_ns_direct_show, NULL);
+static struct kobj_attribute transfer_ns_generic_attribute = __ATTR(transfer_ns_generic, 0444, transfer_ns_generic_show, NULL);
+static struct kobj_attribute poll_period_ns_attribute = __ATTR(poll_period_ns, 0444, poll_period_ns_show, NULL);
+static struct kobj_attribute poll_jitter_ns_attribute = __ATTR(poll_jitter_ns, 0444, poll_jitter_ns_show, NULL);
+static struct kobj_attribute periodic_attribute = __ATTR(periodic, 0644, periodic_show, periodic_store);
+static struct kobj_attribute io_ns_attribute = __ATTR(io_ns, 0444, io_ns_show, NULL);
+
+#define LINTAP_TIMING_ATTR(_name, _phase) \
+	static struct lintap_timing_attribute _name##_attribute = { __ATTR(_name, 0644, timing_ns_show, timing_ns_store), _phase }
+
+LINTAP_TIMING_ATTR(select_setup_ns, PHASE_SELECT_SETUP);
+LINTAP_TIMING_ATTR(clock_low_ns, PHASE_CLOCK_LOW);
+LINTAP_TIMING_ATTR(clock_high_ns, PHASE_CLOCK_HIGH);
+LINTAP_TIMING_ATTR(byte_gap_ns, PHASE_BYTE_GAP);
+
+static struct attribute* lintap_attrs[] = {
+	&bit_delay_attribute.attr,
+	&cmd_delay_attribute.attr,
+	&calibrate_attribute.attr,
+	&transfer_path_attribute.attr,
+	&transfer_ns_direct_attribute.attr,
+	&transfer_ns_generic_attribute.attr,
+	&poll_period_ns_attribute.attr,
+	&poll_jitter_ns_attribute.attr,
+	&periodic_attribute.attr,
+	&io_ns_attribute.attr,
+	&select_setup_ns_attribute.attr.attr,
+	&clock_low_ns_attribute.attr.attr,
+	&clock_high_ns_attribute.attr.attr,
+	&byte_gap_ns_attribute.attr.attr,
+	NULL,
+};
+
+// Called when the last reference to the port's kobject goes, after its sysfs directory is removed
+static void lintap_kobj_release(struct kobject* kobj)
+{
+	struct lintap_device* lintap = to_lintap_device(kobj);
+
+	vfree(lintap->ring);  //no longer mapped, as each mapping holds the file and so a reference
+	vfree(lintap->capture);
+	vfree(lintap->replay);
+	kfree(lintap);  //free lintap and pads memory
+}
+
+static struct kobj_type lintap_ktype = {
+	.release = lintap_kobj_release,
+	.sysfs_ops = &kobj_sysfs_ops,
+	.default_attrs = lintap_attrs,
+};
+
+// Returns true if the port is driven by parport_pc, so its registers can be accessed directly
+// at its base address.  PARPORT_MODE_PCSPP alone isn't enough, as some other drivers set it
+// for ports with PC compatible registers which aren't in I/O space
+static bool lintap_port_is_pc(const struct parport* port)
+{
+	return (port->modes & PARPORT_MODE_PCSPP) && port->base != 0 && port->dev != NULL &&
+		strcmp(dev_driver_string(port->dev), "parport_pc") == 0;
+}
+
+static void attach_to_parport(struct parport* port) {
+	struct lintap_device* new_lintap = (struct lintap_device*)kmalloc(sizeof(struct lintap_device), GFP_KERNEL);
+#ifdef DEBUG
+	printk("New parallel port is available for register!\n"); printk(" - Name: %s\n",port->name); printk(" - Number: %d\n",port->number);
+	printk("Available modes :");if (port->modes&PARPORT_MODE_PCSPP)	{ printk("SPP "); } if (port->modes&PARPORT_MODE_TRISTATE) { printk("TRISTATE "); }
+	if (port->modes&PARPORT_MODE_COMPAT) { printk("COMPAT "); } if (port->modes&PARPORT_MODE_EPP) { printk("EPP "); }
+	if (port->modes&PARPORT_MODE_ECP) { printk("ECP "); } if (port->modes&PARPORT_MODE_DMA) { printk("DMA "); }	printk("\n");
+#endif //DEBUG
+
+	if (new_lintap != NULL) { //kmalloc for new structure succeeded
+		memset(new_lintap, 0, sizeof(struct lintap_device));  //Zero out new allocated structure
+		new_lintap->port_dev = parport_register_device(port, "Lintap", NULL, NULL, NULL, 0, new_lintap); //attempt to register device
+		if (new_lintap->port_dev != NULL) { //successful registration of driver with port
+			debugk("Successful registration of device\n");
+			new_lintap->timing_ns[PHASE_SELECT_SETUP] = bit_delay * NSEC_PER_USEC;
+			new_lintap->timing_ns[PHASE_CLOCK_LOW] = bit_delay * NSEC_PER_USEC;
+			new_lintap->timing_ns[PHASE_CLOCK_HIGH] = bit_delay * NSEC_PER_USEC;
+			new_lintap->timing_ns[PHASE_BYTE_GAP] = cmd_delay * NSEC_PER_USEC;
+			if (lintap_port_is_pc(port)) { new_lintap->io_base = port->base; }
+			new_lintap->transfer_path = (direct_io && new_lintap->io_base != 0) ? TRANSFER_PATH_DIRECT : TRANSFER_PATH_GENERIC;
+			printk(KERN_INFO "lintap: %s using %s transfer path\n", port->name, transfer_path_names[new_lintap->transfer_path]);
+			new_lintap->calibrated = !calibrate;
+			// Everything the sysfs and debugfs files use must be set up before they appear
+            init_psxpads(new_lintap);
+			mutex_init(&new_lintap->lock);
+			init_waitqueue_head(&new_lintap->bus_wait);
+			spin_lock_init(&new_lintap->capture_lock);
+			mutex_init(&new_lintap->replay_lock);
+			new_lintap->periodic = true;
+			new_lintap->use_engine = timer_engine;
+			lintap_engine_init(new_lintap);
+			init_lintap_timer(new_lintap);
+			INIT_DELAYED_WORK(&new_lintap->probe_work, lintap_probe_work_func);
+			// From here on the kobject owns the structure and frees it when released
+			if (kobject_init_and_add(&new_lintap->kobj, &lintap_ktype, &THIS_MODULE->mkobj.kobj, "%s", port->name) != 0) {
+				debugk("Failed to create sysfs directory for %s\n", port->name);
+				parport_unregister_device(new_lintap->port_dev);
+				kobject_put(&new_lintap->kobj);
+				return;
+			}
+			lintap_debugfs_init(new_lintap);
+			mutex_lock(&lintap_list_lock);
+			list_add(&new_lintap->list, &lintap_list);
+			mutex_unlock(&lintap_list_lock);
+			lintap_ring_init(new_lintap);
+			if (aggregate) { lintap_aggregate_init(new_lintap); }
+			schedule_delayed_work(&new_lintap->probe_work, 0);	//look for pads straight away
+		} else {
+			debugk("Failed to register device: \n");
+			kfree(new_lintap); //free memory
+		}
+
+	} else {
+		debugk("Error - could not allocate memory for lintap device\n");
+	}
+}
+
+// Tear down a lintap device which has already been taken off the list.  Probing is stopped first
+// so no more pads get registered, then the port is marked detached under the lock so that opening
+// a pad or calibrating can't claim it again while its poller is stopped and the pads are removed.
+// Finally, release the kernel memory for the Lintap structure
+static void lintap_destroy(struct lintap_device* lintap)
+{
+	int pad_count;
+
+	cancel_delayed_work_sync(&lintap->probe_work);
+	// No more opens of the character device once it is deregistered.  Files already open keep
+	// their reference to the lintap device, and readers are woken up to find it detached
+	if (lintap->ring != NULL) { misc_deregister(&lintap->ring_dev); }
+	mutex_lock(&lintap->lock);
+	lintap->detached = true;
+	// Stop polling first before releasing parallel port
+	if (lintap->polling_active) { stop_lintap_polling(lintap); }
+	if (lintap->port_claimed) { lintap_release_port(lintap); }
+	mutex_unlock(&lintap->lock);
+	if (lintap->ring != NULL) { wake_up_interruptible(&lintap->ring_wait); }
+
+	// Unregister each pad device.  Pads still open are closed by this, which only drops use counts now
+	if (rcu_access_pointer(lintap->aggregate_dev) != NULL) { lintap_aggregate_remove(lintap); }
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+	{
+		if (rcu_access_pointer(lintap->pads[pad_count].dev) != NULL) { unregister_psxpad_device(&lintap->pads[pad_count]); }
+	}
+	debugk("Unregistering device: %s\n", lintap->port_dev->name);
+	parport_unregister_device(lintap->port_dev);
+	debugfs_remove_recursive(lintap->debugfs_dir);
+	kobject_put(&lintap->kobj);  //remove sysfs directory, then free lintap and pads memory
+}
+
+// Handle a port going away, or the driver being unregistered.  Only the lintap device of that
+// port is removed, pads on other ports carry on being polled
+static void detach_from_parport(struct parport *port) {
+	struct lintap_device* lintap;
+	struct lintap_device* found = NULL;
+
+	mutex_lock(&lintap_list_lock);
+	list_for_each_entry(lintap, &lintap_list, list)
+	{
+		if (lintap->port_dev->port == port) { found = lintap; break; }
+	}
+	if (found != NULL) { list_del(&found->list); }
+	mutex_unlock(&lintap_list_lock);
+
+	if (found != NULL)
+	{
+		debugk("detach_from_parport() - Lintap is being detached from %s\n", port->name);
+		lintap_destroy(found);
+	}
+}
+
+// Set up the module.  Register it as a parallel port driver with handler functions to attach
+// and detach to and from parallel ports.  Each port gets its own poller when it is attached
+static int __init lintap_module_init(void) {
+    // lintap.h gives userspace its own copies of these, which the frames and capture records are sized by
+    BUILD_BUG_ON(LINTAP_MAX_PADS != MAX_PADS);
+    BUILD_BUG_ON(LINTAP_MAX_AXES != MAX_AXES);
+    BUILD_BUG_ON(LINTAP_MAX_TRANSFER_BYTES != PSX_MAX_TRANSFER_BYTES);
+
+    debugk("!!!!!!!!LINTAP INIT!!!!!\n");
+	debugfs_root = debugfs_create_dir("lintap", NULL);
+	// Without the handler the benchmark and replay can't keep their events to themselves, so don't run
+	if (input_register_handler(&lintap_scratch_handler) == 0) { registered_scratch_handler = true; }
+	if (parport_register_driver(&lintap_driver)) {
+		debugk("Error registering Lintap parport driver.\n");
+	} else {
+		debugk("Lintap parport driver registered successfully.\n");
+		registered_with_parport = true;
+	}
+	return 0;
+}
+
+static void __exit lintap_module_exit(void)
+{
+    if (registered_with_parport) {
+        debugk("Unregistering parport driver.\n");
+        // Unregistering the driver detaches it from every port, which stops the poller of each
+        // lintap device and removes it
+		parport_unregister_driver(&lintap_driver);
+		registered_with_parport = false;
+	} else {
+		debugk("Driver is not registered, module exiting.\n");
+	}
+
+	// Remove anything the parport core didn't detach
+	mutex_lock(&lintap_list_lock);
+	while (!list_empty(&lintap_list))
+    {
+		struct lintap_device* lintap = list_first_entry(&lintap_list, struct lintap_device, list);
+		list_del(&lintap->list);
+		lintap_destroy(lintap);
 	}
+	mutex_unlock(&lintap_list_lock);
+	debugfs_remove_recursive(debugfs_root);
+	if (registered_scratch_handler) { input_unregister_handler(&lintap_scratch_handler); }
 }
 
 module_init(lintap_module_init);  //tell kernel to use lintap_module_init routine
@@ -0,0 +1,79 @@
+// Userspace interface of the lintap character devices, /dev/lintap-<port name>.  There is one
+// for each parallel port, which can be used alongside the input devices of the pads.
+//
+// Every poll of the port writes one lintap_frame into a ring buffer, which can be mapped
+// read only with mmap at offset 0.  The frame with sequence number n is in frames[n % frames],
+// and head is the sequence number of the newest frame, 0 until the first poll.  The writer makes
+// seqcount odd while it is writing a frame and even again once head has been moved on, so a
+// reader which copies a frame and finds seqcount even and unchanged before and after the copy
+// (with read barriers either side) has a consistent frame.  Frames older than head - frames + 1
+// have been overwritten.
+//
+// read() returns the newest frame once there is one newer than the last one read through the
+// same file, blocking unless the file is non-blocking, and poll() reports the file readable when
+// there is.  Opening the device claims the port and starts polling it, like opening a pad.
+//
+// LINTAP_IOC_POLL_NOW polls the port immediately and returns the resulting frame, so a program
+// can sample the pads right when it needs them.  Writing 0 to periodic in the port's directory
+// under /sys/module/lintap/ stops the periodic polls, so the pads are only read on request.
+//
+// With the capture module parameter set, each port also records the raw status register samples
+// and the decoded pads of its last transactions, which can be read as lintap_capture_records,
+// oldest first, from capture in the port's debugfs directory.  Writing records to replay in the
+// same directory stores them to be decoded and reported again when replay is read.
+
+#ifndef _LINTAP_H
+#define _LINTAP_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define LINTAP_RING_FRAMES		256			//frames in the ring, a power of 2
+// The driver's own limits, which lintap.c checks these against when it is built
+#define LINTAP_MAX_PADS			4
+#define LINTAP_MAX_AXES			4
+#define LINTAP_MAX_TRANSFER_BYTES	9			//start, ID, status and the longest payload
+
+// State of one pad slot, as read from the port
+struct lintap_pad_frame {
+	__u8 pad_id;							//bits 7-4 = controller type, 3-0 = payload words.  Whatever was read if the pad is missing
+	__u8 pad_status;						//0x5A if the pad answered
+	__u8 button_status[2];					//raw button bytes, a bit is 0 while its button is pressed.  0xFF on missing pads
+	__u8 axes[LINTAP_MAX_AXES];				//right X, right Y, left X, left Y.  0x80 on digital and missing pads
+};
+
+struct lintap_frame {
+	__u64 timestamp_ns;						//CLOCK_MONOTONIC time the poll started
+	__u64 sequence;							//sequence number of the frame, starting at 1
+	__u32 present_mask;						//bit n set if pad n answered with a valid ID and status
+	__u32 reserved;
+	struct lintap_pad_frame pads[LINTAP_MAX_PADS];
+};
+
+struct lintap_ring_header {
+	__u32 seqcount;							//odd while a frame is being written
+	__u32 frames;							//number of frames in the ring, LINTAP_RING_FRAMES
+	__u32 frame_size;						//sizeof(struct lintap_frame)
+	__u32 reserved;
+	__u64 head;								//sequence number of the newest frame
+};
+
+struct lintap_ring {
+	struct lintap_ring_header header;
+	struct lintap_frame frames[LINTAP_RING_FRAMES];
+};
+
+// One transaction recorded by the capture
+struct lintap_capture_record {
+	__u64 timestamp_ns;						//CLOCK_MONOTONIC time the transaction started
+	__u32 present_mask;						//bit n set if pad n answered with a valid ID and status
+	__u8 length;							//bytes transferred, samples of later bytes are 0xFF
+	__u8 reserved[3];
+	__u8 samples[LINTAP_MAX_TRANSFER_BYTES][8];	//status register read for each bit of each byte
+	struct lintap_pad_frame pads[LINTAP_MAX_PADS];	//pads as decoded from the samples
+};
+
+#define LINTAP_IOC_MAGIC		'L'
+#define LINTAP_IOC_POLL_NOW		_IOR(LINTAP_IOC_MAGIC, 0x01, struct lintap_frame)
+
+#endif // _LINTAP_H
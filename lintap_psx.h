@@ -0,0 +1,118 @@
+// Megatap protocol shared by the driver, lintap.c, and the userspace daemon, lintapd.c: the port
+// lines, the commands and responses of the pads, the events the pads are reported with, and the
+// decoding of a transaction's status register samples into the bytes sent by each pad.
+// It includes nothing itself, so either the kernel or the C library can provide uint8_t,
+// uint16_t and uint64_t and the input event codes before it is included.
+
+#ifndef _LINTAP_PSX_H
+#define _LINTAP_PSX_H
+
+#define LINTAP_VERSION 15032015
+
+#define PSX_COMMAND             0x01		//00000001b	//bit 0 of data register
+#define PSX_SELECT_ALL          0x02		//00000010b	//bit 1 of data register
+#define PSX_CLOCK               0x04		//00000100b	//bit 2 of data register
+
+#define PSX_DATA_0              0x08		//00001000b	//bit 3 of status register
+#define PSX_DATA_1              0x10		//00010000b	//bit 4 of status register
+#define PSX_DATA_2              0x20		//00100000b	//bit 5 of status register
+#define PSX_DATA_3              0x40		//01000000b	//bit 6 of status register
+
+#define PSX_DATA_SHIFT          3			//bit of status register carrying pad 0 data, pads 1-3 follow on
+
+#define PSX_ACKNOWLEDGE			0x80		//10000000b	//bit 7 of status register, set while a pad pulls ACK low (busy line is inverted by the port)
+
+#define PSX_COMMAND_START		0x01		//init start state command
+#define PSX_COMMAND_TRANSFER	0x42		//request pad status command
+#define PSX_NORMAL_PAD_ID		0x41		//what pad should return in response to start command
+#define PSX_NORMAL_STATUS		0x5a		//what pad should return in response to status request
+
+#define PSX_TYPE_DIGITAL		0x40		//pad types in the high nibble of the pad ID, low nibble is payload length in words
+#define PSX_TYPE_ANALOG_STICK	0x50
+#define PSX_TYPE_ANALOG			0x70
+
+#define PSX_BIT_DELAY				5			//number of useconds
+#define PSX_CMD_DELAY				10
+#define PSX_ACK_TIMEOUT				100			//default time to wait for pads to acknowledge a byte (usecs)
+
+#define MAX_PADS				4			//maximum number of pads that can be connected
+#define MAX_BUTTONS				12			//number of buttons on pad, L3 and R3 only on analog pads
+#define MAX_AXES				4			//number of analog axes on analog pads
+
+#define PSX_PAD_ID				7			//product ID of the input device of each pad
+
+#define PSX_BUTTONS_RELEASED	0xFFFF		//button status with no buttons pressed, also used for missing pads
+
+#define PSX_MAX_PAYLOAD_BYTES	6			//longest payload read from a pad: 2 x buttons, 4 x analog axes
+#define PSX_MAX_TRANSFER_BYTES	(PSX_BYTE_BUTTONS + PSX_MAX_PAYLOAD_BYTES)	//start, ID, status and the longest payload
+#define PSX_BYTE_ID				1			//index of each response byte within the transaction
+#define PSX_BYTE_STATUS			2
+#define PSX_BYTE_BUTTONS		3
+#define PSX_BYTE_AXES			5
+#define PSX_AXIS_CENTRE			0x80		//analog axis value with the stick centred, also used for digital and missing pads
+#define PSX_AXIS_FUZZ			2			//analog axis noise, smaller movements aren't treated as input
+
+typedef enum PSX_Status_Mask {PSX_LEFT = 0x0080, PSX_DOWN = 0x0040, PSX_RIGHT = 0x0020,
+	PSX_UP = 0x0010, PSX_START = 0x0008, PSX_SELECT = 0x0001, PSX_SQUARE = 0x8000, PSX_CROSS = 0x4000,
+	PSX_CIRCLE = 0x2000, PSX_TRIANGLE = 0x1000, PSX_RIGHT1 = 0x0800, PSX_LEFT1 = 0x0400,
+	PSX_RIGHT2 = 0x0200, PSX_LEFT2 = 0x0100, PSX_LEFT3 = 0x0002, PSX_RIGHT3 = 0x0004} psx_status_mask;
+
+static const uint16_t psxpad_button_events[MAX_BUTTONS] = { BTN_TL2, BTN_TR2, BTN_TL, BTN_TR, BTN_Y, BTN_X, BTN_B, BTN_A , BTN_START, BTN_SELECT,
+	BTN_THUMBL, BTN_THUMBR };
+static const uint16_t psxpad_button_masks[MAX_BUTTONS] = { PSX_LEFT2, PSX_RIGHT2, PSX_LEFT1, PSX_RIGHT1, PSX_TRIANGLE, PSX_CIRCLE,
+	PSX_CROSS, PSX_SQUARE, PSX_START, PSX_SELECT, PSX_LEFT3, PSX_RIGHT3 };	//bit in button status for each of the button events
+static const uint16_t psxpad_axis_events[MAX_AXES] = { ABS_RX, ABS_RY, ABS_Z, ABS_RZ };	//right stick, then left stick
+static const uint8_t psx_status_commands[PSX_MAX_TRANSFER_BYTES] = { PSX_COMMAND_START, PSX_COMMAND_TRANSFER };	//command byte sent for each byte of the transaction, the rest are 0
+
+// Turns the 8 status register samples taken while one byte was transferred into the byte received
+// from each of the 4 pads in one pass.  The samples are treated as an 8x8 bit matrix, one sample
+// per row, and transposed with three rounds of masked shifts and swaps.  Row n of the result then
+// holds bit n of every sample, so row PSX_DATA_SHIFT + pad is the byte sent by that pad.
+static inline void psxpads_decode_byte(const uint8_t samples[8], uint8_t store[MAX_PADS])
+{
+	uint64_t matrix = 0;
+	int count;
+
+	for (count = 0; count < 8; count++) { matrix |= (uint64_t)samples[count] << (count * 8); }
+
+	matrix = (matrix & 0xAA55AA55AA55AA55ULL) | ((matrix & 0x00AA00AA00AA00AAULL) << 7) | ((matrix >> 7) & 0x00AA00AA00AA00AAULL);
+	matrix = (matrix & 0xCCCC3333CCCC3333ULL) | ((matrix & 0x0000CCCC0000CCCCULL) << 14) | ((matrix >> 14) & 0x0000CCCC0000CCCCULL);
+	matrix = (matrix & 0xF0F0F0F00F0F0F0FULL) | ((matrix & 0x00000000F0F0F0F0ULL) << 28) | ((matrix >> 28) & 0x00000000F0F0F0F0ULL);
+
+	for (count = 0; count < MAX_PADS; count++) { store[count] = (uint8_t)(matrix >> ((PSX_DATA_SHIFT + count) * 8)); }
+}
+
+// Number of payload bytes (buttons, then any analog axes) a pad sends after its status byte,
+// from the payload length in words in the low nibble of its ID.  Returns 0 for IDs of unknown
+// pad types, which includes an empty slot reading 0xFF
+static inline int psxpad_payload_bytes(uint8_t pad_id)
+{
+	switch (pad_id & 0xF0)
+	{
+		case PSX_TYPE_DIGITAL:
+		case PSX_TYPE_ANALOG_STICK:
+		case PSX_TYPE_ANALOG:
+			return (pad_id & 0x0F) * 2 < PSX_MAX_PAYLOAD_BYTES ? (pad_id & 0x0F) * 2 : PSX_MAX_PAYLOAD_BYTES;
+		default:
+			return 0;
+	}
+}
+
+// Works out how many bytes the transaction needs from the ID byte samples.  If no slot has a
+// pad of a known type it ends after the ID, otherwise it is long enough for the longest payload
+static inline int psxpads_transfer_length(const uint8_t id_samples[8])
+{
+	uint8_t pad_ids[MAX_PADS];
+	int pad_count, payload = 0;
+
+	psxpads_decode_byte(id_samples, pad_ids);
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+	{
+		const int pad_payload = psxpad_payload_bytes(pad_ids[pad_count]);
+		if (pad_payload > payload) { payload = pad_payload; }
+	}
+
+	return payload == 0 ? PSX_BYTE_ID + 1 : PSX_BYTE_BUTTONS + payload;
+}
+
+#endif // _LINTAP_PSX_H
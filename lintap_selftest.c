@@ -0,0 +1,253 @@
+// lintap_selftest - checks lintap's decoding against the pads simulated by lintap_sim.ko.
+// Each case sets lintap_sim's parameters through /sys/module/lintap_sim/parameters/, polls a
+// simulated port with LINTAP_IOC_POLL_NOW and compares the frames with the IDs, buttons and
+// axes the pads were set to send, including what should happen with and without acknowledges
+// and with every bit sent by the pads flipped.  Prints PASS or FAIL for each case and exits
+// non-zero if any failed.  The parameters of both modules are put back afterwards.
+//
+// Build with "make lintap_selftest", load lintap and lintap_sim and run it as root with the
+// character device of a simulated port, for example "./lintap_selftest /dev/lintap-parport1".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "lintap.h"
+
+/* Constants Definitions */
+
+#define SIM_PARAMETERS			"/sys/module/lintap_sim/parameters/"
+#define LINTAP_PARAMETERS		"/sys/module/lintap/parameters/"
+
+#define PSX_NORMAL_STATUS		0x5A
+#define PSX_AXIS_CENTRE			0x80
+
+#define SELFTEST_POLLS			20			//polls checked for each case
+#define PARAMETER_LENGTH		64
+
+/* End Constants */
+
+/* Data Structures */
+
+// What lintap_sim is set to for one case, and the frame lintap should read from it.  Pads not in
+// expected_mask are compared field by field all the same, as lintap reports what it read from them
+struct selftest_case {
+	const char* name;
+	unsigned int present;
+	uint16_t pad_id[LINTAP_MAX_PADS];
+	uint16_t pad_status[LINTAP_MAX_PADS];
+	uint16_t buttons[LINTAP_MAX_PADS];
+	uint16_t axes[LINTAP_MAX_PADS];
+	bool ack;
+	bool handshake;							//lintap's ack_handshake, which has no effect on the timer engine
+	unsigned int bit_errors;
+	uint32_t expected_mask;
+	struct lintap_pad_frame expected[LINTAP_MAX_PADS];
+};
+
+/* Global Variables */
+
+#define NO_PAD					{ 0xFF, 0xFF, { 0xFF, 0xFF }, { PSX_AXIS_CENTRE, PSX_AXIS_CENTRE, PSX_AXIS_CENTRE, PSX_AXIS_CENTRE } }
+#define DIGITAL_PAD(buttons)	{ 0x41, PSX_NORMAL_STATUS, { (buttons) & 0xFF, (buttons) >> 8 }, { PSX_AXIS_CENTRE, PSX_AXIS_CENTRE, PSX_AXIS_CENTRE, PSX_AXIS_CENTRE } }
+#define ANALOG_PAD(id, buttons, axis) { id, PSX_NORMAL_STATUS, { (buttons) & 0xFF, (buttons) >> 8 }, { axis, axis, axis, axis } }
+
+static const struct selftest_case selftest_cases[] = {
+	{ "digital pad", 0x1, { 0x41, 0x41, 0x41, 0x41 }, { 0x5A, 0x5A, 0x5A, 0x5A }, { 0xFFFE, 0xFFFF, 0xFFFF, 0xFFFF }, { 0x80, 0x80, 0x80, 0x80 },
+		true, false, 0, 0x1, { DIGITAL_PAD(0xFFFE), NO_PAD, NO_PAD, NO_PAD } },
+	{ "mixed pads", 0xF, { 0x73, 0x73, 0x41, 0x53 }, { 0x5A, 0x5A, 0x5A, 0x5A }, { 0x7FFF, 0xFF7F, 0x0000, 0xFFFF }, { 0x00, 0xFF, 0x12, 0x34 },
+		true, false, 0, 0xF, { ANALOG_PAD(0x73, 0x7FFF, 0x00), ANALOG_PAD(0x73, 0xFF7F, 0xFF), DIGITAL_PAD(0x0000), ANALOG_PAD(0x53, 0xFFFF, 0x34) } },
+	{ "empty slots", 0x5, { 0x73, 0x73, 0x73, 0x73 }, { 0x5A, 0x5A, 0x5A, 0x5A }, { 0xFFEF, 0xFFEF, 0xEFFF, 0xEFFF }, { 0x40, 0x40, 0xC0, 0xC0 },
+		true, false, 0, 0x5, { ANALOG_PAD(0x73, 0xFFEF, 0x40), NO_PAD, ANALOG_PAD(0x73, 0xEFFF, 0xC0), NO_PAD } },
+	{ "bad status", 0x3, { 0x41, 0x41, 0x41, 0x41 }, { 0x00, 0x5A, 0x5A, 0x5A }, { 0x0000, 0x0000, 0xFFFF, 0xFFFF }, { 0x80, 0x80, 0x80, 0x80 },
+		true, false, 0, 0x2, { { 0x41, 0x00, { 0xFF, 0xFF }, { PSX_AXIS_CENTRE, PSX_AXIS_CENTRE, PSX_AXIS_CENTRE, PSX_AXIS_CENTRE } },
+		DIGITAL_PAD(0x0000), NO_PAD, NO_PAD } },
+	{ "acknowledged", 0xF, { 0x73, 0x73, 0x41, 0x53 }, { 0x5A, 0x5A, 0x5A, 0x5A }, { 0x7FFF, 0xFF7F, 0x0000, 0xFFFF }, { 0x00, 0xFF, 0x12, 0x34 },
+		true, true, 0, 0xF, { ANALOG_PAD(0x73, 0x7FFF, 0x00), ANALOG_PAD(0x73, 0xFF7F, 0xFF), DIGITAL_PAD(0x0000), ANALOG_PAD(0x53, 0xFFFF, 0x34) } },
+	// Without an acknowledge for the start byte the transaction ends before the IDs are read
+	{ "not acknowledged", 0xF, { 0x73, 0x73, 0x41, 0x53 }, { 0x5A, 0x5A, 0x5A, 0x5A }, { 0x7FFF, 0xFF7F, 0x0000, 0xFFFF }, { 0x00, 0xFF, 0x12, 0x34 },
+		false, true, 0, 0x0, { NO_PAD, NO_PAD, NO_PAD, NO_PAD } },
+	{ "acknowledge ignored", 0x1, { 0x73, 0x73, 0x73, 0x73 }, { 0x5A, 0x5A, 0x5A, 0x5A }, { 0xFEFF, 0xFFFF, 0xFFFF, 0xFFFF }, { 0x01, 0x80, 0x80, 0x80 },
+		false, false, 0, 0x1, { ANALOG_PAD(0x73, 0xFEFF, 0x01), NO_PAD, NO_PAD, NO_PAD } },
+	// Every bit flipped turns ID 0x41 into 0xBE, an unknown type, so the transaction ends after the IDs
+	{ "bit errors", 0x1, { 0x41, 0x41, 0x41, 0x41 }, { 0x5A, 0x5A, 0x5A, 0x5A }, { 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF }, { 0x80, 0x80, 0x80, 0x80 },
+		true, false, 1000000, 0x0, { { 0xBE, 0xFF, { 0xFF, 0xFF }, { PSX_AXIS_CENTRE, PSX_AXIS_CENTRE, PSX_AXIS_CENTRE, PSX_AXIS_CENTRE } },
+		NO_PAD, NO_PAD, NO_PAD } },
+};
+
+// Module parameters changed by the tests, and the values they had before
+static const char* const selftest_parameters[] = {
+	SIM_PARAMETERS "present", SIM_PARAMETERS "pad_id", SIM_PARAMETERS "pad_status", SIM_PARAMETERS "buttons",
+	SIM_PARAMETERS "axes", SIM_PARAMETERS "ack", SIM_PARAMETERS "bit_errors", SIM_PARAMETERS "toggle_ms",
+	SIM_PARAMETERS "min_edge_ns", LINTAP_PARAMETERS "ack_handshake",
+};
+
+#define SELFTEST_PARAMETERS		(sizeof(selftest_parameters) / sizeof(selftest_parameters[0]))
+
+static char selftest_saved[SELFTEST_PARAMETERS][PARAMETER_LENGTH];
+
+/* Functions */
+
+static bool selftest_read(const char* path, char* value, size_t length)
+{
+	FILE* file = fopen(path, "r");
+	bool ok;
+
+	if (file == NULL) { perror(path); return false; }
+	ok = fgets(value, length, file) != NULL;
+	fclose(file);
+	if (!ok) { fprintf(stderr, "%s: can't read\n", path); }
+	return ok;
+}
+
+static bool selftest_write(const char* path, const char* value)
+{
+	FILE* file = fopen(path, "w");
+	bool ok;
+
+	if (file == NULL) { perror(path); return false; }
+	ok = fputs(value, file) >= 0;
+	ok = fclose(file) == 0 && ok;
+	if (!ok) { perror(path); }
+	return ok;
+}
+
+static const char* selftest_parameter_path(const char* name)
+{
+	unsigned int count;
+
+	for (count = 0; count < SELFTEST_PARAMETERS; count++)
+	{
+		const char* base = strrchr(selftest_parameters[count], '/') + 1;
+
+		if (strcmp(base, name) == 0) { return selftest_parameters[count]; }
+	}
+	return NULL;
+}
+
+static bool selftest_set(const char* name, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static bool selftest_set(const char* name, const char* format, ...)
+{
+	char value[PARAMETER_LENGTH];
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(value, sizeof(value), format, args);
+	va_end(args);
+	return selftest_write(selftest_parameter_path(name), value);
+}
+
+static bool selftest_set_array(const char* name, const uint16_t values[LINTAP_MAX_PADS])
+{
+	return selftest_set(name, "0x%x,0x%x,0x%x,0x%x", values[0], values[1], values[2], values[3]);
+}
+
+// Set lintap_sim and lintap up for a case
+static bool selftest_apply(const struct selftest_case* test)
+{
+	return selftest_set("present", "0x%x", test->present) && selftest_set_array("pad_id", test->pad_id) &&
+		selftest_set_array("pad_status", test->pad_status) && selftest_set_array("buttons", test->buttons) &&
+		selftest_set_array("axes", test->axes) && selftest_set("ack", "%d", test->ack) &&
+		selftest_set("bit_errors", "%u", test->bit_errors) && selftest_set("ack_handshake", "%d", test->handshake);
+}
+
+// Compare a frame with what the case expects, printing the first difference
+static bool selftest_check(const struct selftest_case* test, const struct lintap_frame* frame)
+{
+	int pad_count;
+
+	if (frame->present_mask != test->expected_mask)
+	{
+		printf("FAIL %s: present mask 0x%x, expected 0x%x\n", test->name, frame->present_mask, test->expected_mask);
+		return false;
+	}
+	for (pad_count = 0; pad_count < LINTAP_MAX_PADS; pad_count++)
+	{
+		const struct lintap_pad_frame* pad = &frame->pads[pad_count];
+		const struct lintap_pad_frame* expected = &test->expected[pad_count];
+
+		if (memcmp(pad, expected, sizeof(struct lintap_pad_frame)) != 0)
+		{
+			printf("FAIL %s: pad %d read ID 0x%02x status 0x%02x buttons 0x%02x%02x axes %02x %02x %02x %02x, "
+				"expected ID 0x%02x status 0x%02x buttons 0x%02x%02x axes %02x %02x %02x %02x\n", test->name, pad_count,
+				pad->pad_id, pad->pad_status, pad->button_status[1], pad->button_status[0],
+				pad->axes[0], pad->axes[1], pad->axes[2], pad->axes[3],
+				expected->pad_id, expected->pad_status, expected->button_status[1], expected->button_status[0],
+				expected->axes[0], expected->axes[1], expected->axes[2], expected->axes[3]);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Run a case, checking SELFTEST_POLLS polls.  Returns -1 if the port couldn't be polled
+static int selftest_run(int fd, const struct selftest_case* test)
+{
+	int poll_count;
+
+	if (!selftest_apply(test)) { return -1; }
+	for (poll_count = 0; poll_count < SELFTEST_POLLS; poll_count++)
+	{
+		struct lintap_frame frame;
+
+		if (ioctl(fd, LINTAP_IOC_POLL_NOW, &frame) != 0) { perror("LINTAP_IOC_POLL_NOW"); return -1; }
+		if (!selftest_check(test, &frame)) { return 0; }
+	}
+	printf("PASS %s\n", test->name);
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	char engine[PARAMETER_LENGTH] = "N";
+	unsigned int count, passed = 0, failed = 0, skipped = 0;
+	bool timer_engine;
+	int fd, result = 0;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "Usage: %s /dev/lintap-<simulated port>\n", argv[0]);
+		return 2;
+	}
+	// The timer engine never waits for acknowledges, so handshake cases don't apply to it
+	selftest_read(LINTAP_PARAMETERS "timer_engine", engine, sizeof(engine));
+	timer_engine = engine[0] == 'Y';
+
+	for (count = 0; count < SELFTEST_PARAMETERS; count++)
+	{
+		if (!selftest_read(selftest_parameters[count], selftest_saved[count], PARAMETER_LENGTH)) { return 2; }
+	}
+	fd = open(argv[1], O_RDONLY);
+	if (fd < 0) { perror(argv[1]); return 2; }
+
+	if (selftest_set("toggle_ms", "0") && selftest_set("min_edge_ns", "0"))
+	{
+		for (count = 0; count < sizeof(selftest_cases) / sizeof(selftest_cases[0]) && result >= 0; count++)
+		{
+			const struct selftest_case* test = &selftest_cases[count];
+
+			if (test->handshake && timer_engine)
+			{
+				printf("SKIP %s: the timer engine doesn't wait for acknowledges\n", test->name);
+				skipped++;
+				continue;
+			}
+			result = selftest_run(fd, test);
+			if (result > 0) { passed++; }
+			else if (result == 0) { failed++; }
+		}
+	}
+	else { result = -1; }
+
+	close(fd);
+	for (count = 0; count < SELFTEST_PARAMETERS; count++) { selftest_write(selftest_parameters[count], selftest_saved[count]); }
+
+	if (result < 0) { fprintf(stderr, "Self test aborted\n"); return 2; }
+	printf("%u passed, %u failed, %u skipped\n", passed, failed, skipped);
+	return failed == 0 ? 0 : 1;
+}
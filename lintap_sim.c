@@ -0,0 +1,362 @@
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/parport.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+
+// Simulated parallel ports with a Megatap and 4 PSX pads on each, for trying out and
+// benchmarking lintap without the hardware.  Each simulated port is registered with the parport
+// core like a real one, so lintap attaches to it as usual and sees its pads through the generic
+// transfer path.  The pads follow the clock, select and command lines written to the data
+// register and answer on the status register, from the module parameters below, which can be
+// changed at any time.  Unloading this module removes the ports, which detaches lintap from them.
+
+/* Module Information */
+
+MODULE_AUTHOR("JS");
+MODULE_DESCRIPTION("Simulated parallel ports with PSX pads for testing lintap");
+MODULE_LICENSE("GPL");
+
+/* Constants Definitions */
+
+// Lines as used by lintap
+#define PSX_COMMAND             0x01		//bit 0 of data register
+#define PSX_SELECT_ALL          0x02		//bit 1 of data register
+#define PSX_CLOCK               0x04		//bit 2 of data register
+#define PSX_DATA_SHIFT          3			//pad data lines are status register bits 3-6
+#define PSX_ACKNOWLEDGE         0x80		//status register bit set while any pad holds ACK low
+
+#define PSX_COMMAND_START       0x01
+#define PSX_COMMAND_TRANSFER    0x42
+#define PSX_NORMAL_STATUS       0x5A
+
+#define PSX_BYTE_ID             1
+#define PSX_BYTE_STATUS         2
+#define PSX_BYTE_BUTTONS        3
+
+#define MAX_PADS                4
+#define MAX_PORTS               4
+#define PSX_PAYLOAD_MAX         6			//bytes after the status byte, for the longest pad type lintap reads
+
+/* End Constants */
+
+/* Parameter Configuration */
+
+static unsigned int ports = 1;
+module_param(ports, uint, 0444);
+MODULE_PARM_DESC(ports, "Number of simulated ports (1-4).  Default 1");
+
+static unsigned int present = 0x1;
+module_param(present, uint, 0644);
+MODULE_PARM_DESC(present, "Mask of slots with a pad in them, bit 0 for pad 0.  Default 0x1");
+
+static ushort pad_id[MAX_PADS] = { 0x41, 0x41, 0x41, 0x41 };
+module_param_array(pad_id, ushort, NULL, 0644);
+MODULE_PARM_DESC(pad_id, "ID byte sent by each pad, 0x41 digital, 0x73 analog.  Default 0x41");
+
+static ushort pad_status[MAX_PADS] = { PSX_NORMAL_STATUS, PSX_NORMAL_STATUS, PSX_NORMAL_STATUS, PSX_NORMAL_STATUS };
+module_param_array(pad_status, ushort, NULL, 0644);
+MODULE_PARM_DESC(pad_status, "Status byte sent by each pad.  Default 0x5A");
+
+static ushort buttons[MAX_PADS] = { 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF };
+module_param_array(buttons, ushort, NULL, 0644);
+MODULE_PARM_DESC(buttons, "Button bytes of each pad, first byte in the low bits, a bit is 0 while pressed.  Default 0xFFFF");
+
+static ushort axes[MAX_PADS] = { 0x80, 0x80, 0x80, 0x80 };
+module_param_array(axes, ushort, NULL, 0644);
+MODULE_PARM_DESC(axes, "Value of every analog axis of each pad.  Default 0x80");
+
+static unsigned int toggle_ms = 0;
+module_param(toggle_ms, uint, 0644);
+MODULE_PARM_DESC(toggle_ms, "Switch the pads between buttons and nothing pressed every toggle_ms msecs, 0 to keep buttons.  Default 0");
+
+static bool ack = true;
+static unsigned int ack_delay_ns = 3000;
+static unsigned int ack_width_ns = 2000;
+module_param(ack, bool, 0644);
+MODULE_PARM_DESC(ack, "Pads acknowledge each byte except their last.  Default 1");
+module_param(ack_delay_ns, uint, 0644);
+MODULE_PARM_DESC(ack_delay_ns, "Time from the end of a byte to the pads pulling ACK low (nsecs).  Default 3000");
+module_param(ack_width_ns, uint, 0644);
+MODULE_PARM_DESC(ack_width_ns, "Time the pads hold ACK low (nsecs).  Default 2000");
+
+static unsigned int bit_errors = 0;
+module_param(bit_errors, uint, 0644);
+MODULE_PARM_DESC(bit_errors, "Bits sent by the pads which are flipped, per million.  Default 0");
+
+static unsigned int min_edge_ns = 0;
+module_param(min_edge_ns, uint, 0644);
+MODULE_PARM_DESC(min_edge_ns, "Shortest time between edges the pads can follow, they stop answering after a quicker edge (nsecs).  Default 0");
+
+/* End Parameter Configuration */
+
+/* Data Structures */
+
+// A simulated port and the state of the transaction on it.  The parport core only lets the
+// device which has claimed the port use it, so nothing here needs locking
+struct lintap_sim {
+	struct parport* port;
+	unsigned char data;						//last value written to the data register
+	unsigned char control;					//control register, only kept so it reads back
+	bool selected;							//TRUE while select is low
+	bool listening;							//FALSE once a pad has seen a command it doesn't answer
+	int byte_count;							//byte of the transaction being transferred
+	int bit_count;							//bit of the byte being transferred
+	uint8_t command;						//command bits received so far in the byte
+	uint8_t status;							//pad data lines, set on each falling clock edge
+	ktime_t ack_start;						//ACK is held low from ack_start to ack_end
+	ktime_t ack_end;
+	ktime_t last_edge;						//time of the last select or clock edge
+};
+
+/* Global Variables */
+static struct lintap_sim* sims[MAX_PORTS];
+
+/* Functions */
+
+// Payload bytes (buttons then axes) a pad with this ID sends after its status byte
+static int lintap_sim_payload(uint8_t id)
+{
+	return min((id & 0x0F) * 2, PSX_PAYLOAD_MAX);
+}
+
+// Byte a pad sends during byte byte_count of the transaction
+static uint8_t lintap_sim_pad_byte(int pad, int byte_count)
+{
+	uint16_t pad_buttons = ACCESS_ONCE(buttons[pad]);
+	const unsigned int toggle = ACCESS_ONCE(toggle_ms);
+
+	if (toggle != 0 && (div_u64(div_u64(ktime_to_ns(ktime_get()), NSEC_PER_MSEC), toggle) & 1)) { pad_buttons = 0xFFFF; }
+
+	switch (byte_count)
+	{
+		case PSX_BYTE_ID:
+			return (uint8_t)ACCESS_ONCE(pad_id[pad]);
+		case PSX_BYTE_STATUS:
+			return (uint8_t)ACCESS_ONCE(pad_status[pad]);
+		case PSX_BYTE_BUTTONS:
+			return pad_buttons & 0xFF;
+		case PSX_BYTE_BUTTONS + 1:
+			return pad_buttons >> 8;
+		default:
+			if (byte_count > PSX_BYTE_BUTTONS && byte_count < PSX_BYTE_BUTTONS + lintap_sim_payload(pad_id[pad])) { return (uint8_t)ACCESS_ONCE(axes[pad]); }
+			return 0xFF;
+	}
+}
+
+// Data lines of every pad for the current bit.  Lines of missing or silent pads float high
+static uint8_t lintap_sim_data_lines(const struct lintap_sim* sim)
+{
+	const unsigned int mask = ACCESS_ONCE(present);
+	const unsigned int errors = ACCESS_ONCE(bit_errors);
+	uint8_t lines = 0;
+	int pad;
+
+	for (pad = 0; pad < MAX_PADS; pad++)
+	{
+		bool bit = true;
+
+		if (sim->listening && (mask & (1 << pad)))
+		{
+			bit = (lintap_sim_pad_byte(pad, sim->byte_count) >> sim->bit_count) & 0x01;
+			if (errors != 0 && prandom_u32() % 1000000 < errors) { bit = !bit; }
+		}
+		if (bit) { lines |= 1 << (PSX_DATA_SHIFT + pad); }
+	}
+
+	return lines;
+}
+
+// True if any pad acknowledges the byte which has just ended
+static bool lintap_sim_acknowledges(const struct lintap_sim* sim)
+{
+	const unsigned int mask = ACCESS_ONCE(present);
+	int pad;
+
+	if (!ACCESS_ONCE(ack) || !sim->listening) { return false; }
+	for (pad = 0; pad < MAX_PADS; pad++)
+	{
+		if ((mask & (1 << pad)) && sim->byte_count < PSX_BYTE_BUTTONS + lintap_sim_payload(pad_id[pad]) - 1) { return true; }
+	}
+	return false;
+}
+
+// End of each byte.  The pads only answer transactions starting with the start and transfer
+// commands, and acknowledge every byte except their last
+static void lintap_sim_end_byte(struct lintap_sim* sim)
+{
+	if ((sim->byte_count == 0 && sim->command != PSX_COMMAND_START) ||
+		(sim->byte_count == PSX_BYTE_ID && sim->command != PSX_COMMAND_TRANSFER)) { sim->listening = false; }
+
+	if (lintap_sim_acknowledges(sim))
+	{
+		sim->ack_start = ktime_add_ns(ktime_get(), ACCESS_ONCE(ack_delay_ns));
+		sim->ack_end = ktime_add_ns(sim->ack_start, ACCESS_ONCE(ack_width_ns));
+	}
+	sim->byte_count++;
+	sim->bit_count = 0;
+	sim->command = 0;
+}
+
+// The pads follow the edges on the select and clock lines.  A falling select edge starts a
+// transaction, the pads put out each bit on the falling clock edge and read the command bit on
+// the rising edge
+static void lintap_sim_write_data(struct parport* port, unsigned char data)
+{
+	struct lintap_sim* sim = (struct lintap_sim*)port->private_data;
+	const unsigned char old = sim->data;
+	const ktime_t now = ktime_get();
+	bool too_soon = false;
+
+	sim->data = data;
+	// Pads lose track of the transaction if an edge comes too soon after the last one, so
+	// lintap's timings can be calibrated against a limit
+	if (((old ^ data) & (PSX_CLOCK | PSX_SELECT_ALL)) != 0)
+	{
+		too_soon = ktime_to_ns(ktime_sub(now, sim->last_edge)) < ACCESS_ONCE(min_edge_ns);
+		sim->last_edge = now;
+	}
+	if (data & PSX_SELECT_ALL)
+	{
+		sim->selected = false;
+		return;
+	}
+	if (!sim->selected)
+	{
+		sim->selected = true;
+		sim->listening = !too_soon;
+		sim->byte_count = 0;
+		sim->bit_count = 0;
+		sim->command = 0;
+		sim->ack_end = sim->ack_start = ktime_set(0, 0);
+		return;
+	}
+
+	if (too_soon) { sim->listening = false; }
+	if ((old & PSX_CLOCK) && !(data & PSX_CLOCK)) { sim->status = lintap_sim_data_lines(sim); }
+	else if (!(old & PSX_CLOCK) && (data & PSX_CLOCK))
+	{
+		sim->command |= (data & PSX_COMMAND) << sim->bit_count;
+		if (++sim->bit_count == 8) { lintap_sim_end_byte(sim); }
+	}
+}
+
+static unsigned char lintap_sim_read_data(struct parport* port)
+{
+	return ((struct lintap_sim*)port->private_data)->data;
+}
+
+static unsigned char lintap_sim_read_status(struct parport* port)
+{
+	const struct lintap_sim* sim = (struct lintap_sim*)port->private_data;
+	const s64 now = ktime_to_ns(ktime_get());
+	unsigned char status = sim->selected ? sim->status : 0x0F << PSX_DATA_SHIFT;
+
+	if (now >= ktime_to_ns(sim->ack_start) && now < ktime_to_ns(sim->ack_end)) { status |= PSX_ACKNOWLEDGE; }
+	return status;
+}
+
+static void lintap_sim_write_control(struct parport* port, unsigned char control)
+{
+	((struct lintap_sim*)port->private_data)->control = control;
+}
+
+static unsigned char lintap_sim_read_control(struct parport* port)
+{
+	return ((struct lintap_sim*)port->private_data)->control;
+}
+
+static unsigned char lintap_sim_frob_control(struct parport* port, unsigned char mask, unsigned char val)
+{
+	struct lintap_sim* sim = (struct lintap_sim*)port->private_data;
+
+	sim->control = (sim->control & ~mask) ^ val;
+	return sim->control;
+}
+
+// Nothing else on the port is simulated, so interrupts, direction and saved state are no-ops
+static void lintap_sim_nop(struct parport* port) { }
+
+static void lintap_sim_init_state(struct pardevice* dev, struct parport_state* state) { }
+
+static void lintap_sim_save_state(struct parport* port, struct parport_state* state) { }
+
+static void lintap_sim_restore_state(struct parport* port, struct parport_state* state) { }
+
+static struct parport_operations lintap_sim_ops = {
+	.write_data = lintap_sim_write_data,
+	.read_data = lintap_sim_read_data,
+	.write_control = lintap_sim_write_control,
+	.read_control = lintap_sim_read_control,
+	.frob_control = lintap_sim_frob_control,
+	.read_status = lintap_sim_read_status,
+	.enable_irq = lintap_sim_nop,
+	.disable_irq = lintap_sim_nop,
+	.data_forward = lintap_sim_nop,
+	.data_reverse = lintap_sim_nop,
+	.init_state = lintap_sim_init_state,
+	.save_state = lintap_sim_save_state,
+	.restore_state = lintap_sim_restore_state,
+	.epp_write_data = parport_ieee1284_epp_write_data,
+	.epp_read_data = parport_ieee1284_epp_read_data,
+	.epp_write_addr = parport_ieee1284_epp_write_addr,
+	.epp_read_addr = parport_ieee1284_epp_read_addr,
+	.ecp_write_data = parport_ieee1284_ecp_write_data,
+	.ecp_read_data = parport_ieee1284_ecp_read_data,
+	.ecp_write_addr = parport_ieee1284_ecp_write_addr,
+	.compat_write_data = parport_ieee1284_write_compat,
+	.nibble_read_data = parport_ieee1284_read_nibble,
+	.byte_read_data = parport_ieee1284_read_byte,
+	.owner = THIS_MODULE,
+};
+
+static void lintap_sim_remove(struct lintap_sim* sim)
+{
+	parport_remove_port(sim->port);	//detaches lintap from the port
+	parport_put_port(sim->port);
+	kfree(sim);
+}
+
+static int __init lintap_sim_init(void)
+{
+	unsigned int count;
+
+	for (count = 0; count < min(ports, (unsigned int)MAX_PORTS); count++)
+	{
+		struct lintap_sim* sim = kzalloc(sizeof(struct lintap_sim), GFP_KERNEL);
+
+		if (sim == NULL) { break; }
+		sim->port = parport_register_port(0, PARPORT_IRQ_NONE, PARPORT_DMA_NONE, &lintap_sim_ops);
+		if (sim->port == NULL)
+		{
+			kfree(sim);
+			break;
+		}
+		sim->port->private_data = sim;
+		sim->port->modes = PARPORT_MODE_COMPAT;
+		sim->data = PSX_CLOCK|PSX_SELECT_ALL;
+		sims[count] = sim;
+		printk(KERN_INFO "lintap_sim: simulating pads on %s\n", sim->port->name);
+		parport_announce_port(sim->port);	//lintap attaches now if it is loaded
+	}
+
+	if (count == 0) { return -ENOMEM; }
+	return 0;
+}
+
+static void __exit lintap_sim_exit(void)
+{
+	int count;
+
+	for (count = 0; count < MAX_PORTS; count++)
+	{
+		if (sims[count] != NULL) { lintap_sim_remove(sims[count]); }
+	}
+}
+
+module_init(lintap_sim_init);
+module_exit(lintap_sim_exit);
@@ -0,0 +1,106 @@
+// Tracepoints for the stages of polling the pads, for use with perf and trace-cmd.
+// Included once by lintap.c with CREATE_TRACE_POINTS defined, which needs lintap_psx.h, for
+// psxpads_decode_byte and MAX_PADS, before the include.
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lintap
+
+#if !defined(_LINTAP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LINTAP_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Start of a poll of a port, with how long after it was due it started
+TRACE_EVENT(lintap_poll_start,
+	TP_PROTO(const char* port, s64 lateness_ns),
+	TP_ARGS(port, lateness_ns),
+	TP_STRUCT__entry(
+		__string(port, port)
+		__field(s64, lateness_ns)
+	),
+	TP_fast_assign(
+		__assign_str(port, port);
+		__entry->lateness_ns = lateness_ns;
+	),
+	TP_printk("port=%s lateness_ns=%lld", __get_str(port), __entry->lateness_ns)
+);
+
+// Pads selected, start of a transaction
+TRACE_EVENT(lintap_select,
+	TP_PROTO(const char* port),
+	TP_ARGS(port),
+	TP_STRUCT__entry(
+		__string(port, port)
+	),
+	TP_fast_assign(
+		__assign_str(port, port);
+	),
+	TP_printk("port=%s", __get_str(port))
+);
+
+// One byte of a transaction clocked.  The raw samples are only decoded into the byte
+// received from each pad when the event is enabled
+TRACE_EVENT(lintap_byte,
+	TP_PROTO(const char* port, int index, uint8_t command, const uint8_t* samples),
+	TP_ARGS(port, index, command, samples),
+	TP_STRUCT__entry(
+		__string(port, port)
+		__field(int, index)
+		__field(uint8_t, command)
+		__array(uint8_t, data, MAX_PADS)
+	),
+	TP_fast_assign(
+		__assign_str(port, port);
+		__entry->index = index;
+		__entry->command = command;
+		psxpads_decode_byte(samples, __entry->data);
+	),
+	TP_printk("port=%s byte=%d command=0x%02x data=%02x %02x %02x %02x", __get_str(port), __entry->index,
+		__entry->command, __entry->data[0], __entry->data[1], __entry->data[2], __entry->data[3])
+);
+
+// Pads deselected, end of a transaction, with the number of bytes it took
+TRACE_EVENT(lintap_deselect,
+	TP_PROTO(const char* port, int bytes),
+	TP_ARGS(port, bytes),
+	TP_STRUCT__entry(
+		__string(port, port)
+		__field(int, bytes)
+	),
+	TP_fast_assign(
+		__assign_str(port, port);
+		__entry->bytes = bytes;
+	),
+	TP_printk("port=%s bytes=%d", __get_str(port), __entry->bytes)
+);
+
+// Changes in a pad's state reported to its input device
+TRACE_EVENT(lintap_report,
+	TP_PROTO(const char* port, int pad, uint8_t pad_id, uint16_t button_status, uint16_t changed),
+	TP_ARGS(port, pad, pad_id, button_status, changed),
+	TP_STRUCT__entry(
+		__string(port, port)
+		__field(int, pad)
+		__field(uint8_t, pad_id)
+		__field(uint16_t, button_status)
+		__field(uint16_t, changed)
+	),
+	TP_fast_assign(
+		__assign_str(port, port);
+		__entry->pad = pad;
+		__entry->pad_id = pad_id;
+		__entry->button_status = button_status;
+		__entry->changed = changed;
+	),
+	TP_printk("port=%s pad=%d id=0x%02x buttons=0x%04x changed=0x%04x", __get_str(port), __entry->pad,
+		__entry->pad_id, __entry->button_status, __entry->changed)
+);
+
+#endif // _LINTAP_TRACE_H
+
+// The header isn't in the kernel's include/trace/events, so tell define_trace.h where it is
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lintap_trace
+#include <trace/define_trace.h>
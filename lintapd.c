@@ -0,0 +1,630 @@
+// lintapd - userspace version of the lintap driver, for hosts where the module can't be loaded.
+// Talks the same Megatap protocol as lintap.c to the pads through ppdev (/dev/parportN) and
+// publishes each pad through uinput, with the same events as the driver.  Polls from a
+// SCHED_FIFO thread with its memory locked, sleeping to absolute deadlines with clock_nanosleep.
+// The port can also be simulated in process, to benchmark the poll loop on any machine.
+//
+// Build with "make lintapd".  Needs read/write access to the parport device and /dev/uinput,
+// and CAP_SYS_NICE and CAP_IPC_LOCK for real time scheduling and locked memory.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/ppdev.h>
+#include <linux/parport.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "lintap_psx.h"
+
+/* Constants Definitions */
+
+#define POLL_HZ					100
+#define POLL_PRIORITY			50
+#define PAD_MISSED_SECONDS		2			//a pad has to be missing this long before its device is removed
+#define UINPUT_RETRY_SECONDS	5			//time before trying to create a device again after failing
+
+#define SIM_ACK_DELAY_NS		3000		//simulated pads pull ACK low this long after the last rising edge of a byte
+#define SIM_ACK_WIDTH_NS		2000		//and hold it low for this long, the same as lintap_sim's defaults
+
+#define NSEC_PER_USEC			1000ULL
+#define NSEC_PER_SEC			1000000000ULL
+
+/* End Constants */
+
+/* Data Structures */
+
+// Simulated port, modelling a Megatap with pads the same way as lintap_sim.ko
+struct lintapd_sim {
+	unsigned int present;					//mask of slots with a pad
+	uint8_t pad_id;							//ID sent by every pad
+	unsigned int toggle_ms;					//buttons switch between all pressed and released this often, 0 for never
+	uint8_t data;
+	bool selected;
+	int byte_count;
+	int bit_count;
+	uint8_t command;
+	uint8_t status;
+	uint64_t ack_start;
+	uint64_t ack_end;
+};
+
+// A parallel port, either a real one through ppdev or a simulated one
+struct lintapd_port {
+	void (*write_data)(struct lintapd_port* port, uint8_t data);
+	uint8_t (*read_status)(struct lintapd_port* port);
+	int fd;									//ppdev file, -1 for the simulated port
+	struct lintapd_sim sim;
+};
+
+struct psx_pad {
+	uint8_t pad_id;
+	uint8_t pad_status;
+	uint16_t button_status;					//both button bytes, first byte in the low bits
+	uint16_t reported_status;
+	uint8_t axes[MAX_AXES];
+	uint8_t reported_axes[MAX_AXES];
+	bool present;
+	int missed_polls;						//consecutive polls the pad has been missing for
+	int uinput_fd;							//uinput device of the pad, -1 while there is none
+};
+
+// Time taken by one stage of polling, in nsecs
+struct lintapd_timing {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+};
+
+/* Global Variables */
+
+static unsigned int bit_delay = PSX_BIT_DELAY;
+static unsigned int cmd_delay = PSX_CMD_DELAY;
+static bool ack_handshake = false;
+static unsigned int ack_timeout = PSX_ACK_TIMEOUT;
+static volatile sig_atomic_t running = 1;
+static uint64_t uinput_retry = 0;			//no devices are created before this time, after a failure
+
+/* Functions */
+
+static inline uint64_t lintapd_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+// Busy wait, as sleeping can't give microsecond delays
+static void lintapd_udelay(unsigned int usecs)
+{
+	const uint64_t end = lintapd_now() + usecs * NSEC_PER_USEC;
+
+	while (lintapd_now() < end) { }
+}
+
+/* ppdev backend */
+
+static void lintapd_ppdev_write_data(struct lintapd_port* port, uint8_t data)
+{
+	ioctl(port->fd, PPWDATA, &data);
+}
+
+static uint8_t lintapd_ppdev_read_status(struct lintapd_port* port)
+{
+	uint8_t status = 0;
+
+	ioctl(port->fd, PPRSTATUS, &status);
+	return status;
+}
+
+// Open a parport device and claim the port for as long as the daemon runs
+static bool lintapd_ppdev_open(struct lintapd_port* port, const char* path)
+{
+	port->fd = open(path, O_RDWR);
+	if (port->fd < 0) { perror(path); return false; }
+	if (ioctl(port->fd, PPEXCL) != 0) { fprintf(stderr, "%s: can't get exclusive access, sharing the port\n", path); }
+	if (ioctl(port->fd, PPCLAIM) != 0)
+	{
+		perror("PPCLAIM");
+		close(port->fd);
+		return false;
+	}
+	port->write_data = lintapd_ppdev_write_data;
+	port->read_status = lintapd_ppdev_read_status;
+	return true;
+}
+
+/* Simulated backend.  The pads follow select and clock edges, put out each bit on the falling
+   clock edge, read the command bit on the rising edge and acknowledge every byte but their last */
+
+static int lintapd_sim_payload(uint8_t id)
+{
+	return (id & 0x0F) * 2 < PSX_MAX_PAYLOAD_BYTES ? (id & 0x0F) * 2 : PSX_MAX_PAYLOAD_BYTES;
+}
+
+static uint8_t lintapd_sim_pad_byte(const struct lintapd_sim* sim, int byte_count)
+{
+	uint16_t buttons = PSX_BUTTONS_RELEASED;
+
+	if (sim->toggle_ms != 0 && (lintapd_now() / (sim->toggle_ms * 1000000ULL)) & 1) { buttons = 0; }
+	switch (byte_count)
+	{
+		case PSX_BYTE_ID: return sim->pad_id;
+		case PSX_BYTE_STATUS: return PSX_NORMAL_STATUS;
+		case PSX_BYTE_BUTTONS: return buttons & 0xFF;
+		case PSX_BYTE_BUTTONS + 1: return buttons >> 8;
+		default: return byte_count > PSX_BYTE_BUTTONS && byte_count < PSX_BYTE_BUTTONS + lintapd_sim_payload(sim->pad_id) ? PSX_AXIS_CENTRE : 0xFF;
+	}
+}
+
+static void lintapd_sim_write_data(struct lintapd_port* port, uint8_t data)
+{
+	struct lintapd_sim* sim = &port->sim;
+	const uint8_t old = sim->data;
+
+	sim->data = data;
+	if (data & PSX_SELECT_ALL) { sim->selected = false; return; }
+	if (!sim->selected)
+	{
+		sim->selected = true;
+		sim->byte_count = sim->bit_count = 0;
+		sim->command = 0;
+		sim->ack_start = sim->ack_end = 0;
+		return;
+	}
+
+	if ((old & PSX_CLOCK) && !(data & PSX_CLOCK))
+	{
+		const uint8_t bit = (lintapd_sim_pad_byte(sim, sim->byte_count) >> sim->bit_count) & 0x01;
+		int pad;
+
+		sim->status = 0;
+		for (pad = 0; pad < MAX_PADS; pad++)
+		{
+			if (!(sim->present & (1 << pad)) || bit) { sim->status |= 1 << (PSX_DATA_SHIFT + pad); }
+		}
+	}
+	else if (!(old & PSX_CLOCK) && (data & PSX_CLOCK))
+	{
+		sim->command |= (data & PSX_COMMAND) << sim->bit_count;
+		if (++sim->bit_count == 8)
+		{
+			// Like a real pad the ACK pulse is timed from the last rising edge of the byte,
+			// whatever the host does after it
+			if (sim->present != 0 && sim->byte_count < PSX_BYTE_BUTTONS + lintapd_sim_payload(sim->pad_id) - 1)
+			{
+				sim->ack_start = lintapd_now() + SIM_ACK_DELAY_NS;
+				sim->ack_end = sim->ack_start + SIM_ACK_WIDTH_NS;
+			}
+			sim->byte_count++;
+			sim->bit_count = 0;
+			sim->command = 0;
+		}
+	}
+}
+
+static uint8_t lintapd_sim_read_status(struct lintapd_port* port)
+{
+	const struct lintapd_sim* sim = &port->sim;
+	const uint64_t now = lintapd_now();
+	uint8_t status = sim->selected ? sim->status : 0x0F << PSX_DATA_SHIFT;
+
+	if (now >= sim->ack_start && now < sim->ack_end) { status |= PSX_ACKNOWLEDGE; }
+	return status;
+}
+
+static void lintapd_sim_open(struct lintapd_port* port, unsigned int present, uint8_t pad_id, unsigned int toggle_ms)
+{
+	memset(&port->sim, 0, sizeof(struct lintapd_sim));
+	port->fd = -1;
+	port->sim.present = present;
+	port->sim.pad_id = pad_id;
+	port->sim.toggle_ms = toggle_ms;
+	port->write_data = lintapd_sim_write_data;
+	port->read_status = lintapd_sim_read_status;
+}
+
+/* Megatap protocol, the same as psxpads_capture and psxpads_read_status in lintap.c.  Decoding and
+   the protocol constants are shared with it through lintap_psx.h */
+
+static void psxpads_select(struct lintapd_port* port)
+{
+	port->write_data(port, PSX_CLOCK|PSX_SELECT_ALL);
+	lintapd_udelay(bit_delay);
+	port->write_data(port, PSX_CLOCK);
+	lintapd_udelay(bit_delay);
+}
+
+static void psxpads_deselect(struct lintapd_port* port)
+{
+	port->write_data(port, PSX_CLOCK|PSX_SELECT_ALL);
+}
+
+// Send a command byte LSB first, sampling the status register for each bit.  With the handshake
+// the delay after the last rising edge is left out, as the acknowledge starts a few usecs after it
+static void psxpads_send_command(struct lintapd_port* port, uint8_t command, uint8_t samples[8])
+{
+	int bit_count;
+
+	for (bit_count = 0; bit_count < 8; bit_count++)
+	{
+		uint8_t commbyte = command & 0x01;
+		port->write_data(port, commbyte);
+		lintapd_udelay(bit_delay);
+		samples[bit_count] = port->read_status(port);
+		port->write_data(port, commbyte | PSX_CLOCK);
+		if (!ack_handshake || bit_count < 7) { lintapd_udelay(bit_delay); }
+		command >>= 1;
+	}
+}
+
+// Wait for the shared ACK status bit to be set and cleared again
+static bool psxpads_wait_ack(struct lintapd_port* port)
+{
+	const uint64_t deadline = lintapd_now() + ack_timeout * NSEC_PER_USEC;
+
+	while (!(port->read_status(port) & PSX_ACKNOWLEDGE)) { if (lintapd_now() > deadline) { return false; } }
+	while (port->read_status(port) & PSX_ACKNOWLEDGE) { if (lintapd_now() > deadline) { break; } }
+	return true;
+}
+
+// The last byte is never acknowledged, so it just gets the delay send_command left out
+static bool psxpads_end_byte(struct lintapd_port* port, bool last)
+{
+	if (!ack_handshake) { lintapd_udelay(cmd_delay); }
+	else if (!last) { return psxpads_wait_ack(port); }
+	else { lintapd_udelay(bit_delay); }
+	return true;
+}
+
+// Clock a whole status transaction, returning the number of bytes transferred
+static int psxpads_capture(struct lintapd_port* port, uint8_t samples[PSX_MAX_TRANSFER_BYTES][8])
+{
+	int byte_count, length = PSX_MAX_TRANSFER_BYTES;
+
+	memset(samples, 0xFF, PSX_MAX_TRANSFER_BYTES * 8);
+	psxpads_select(port);
+	for (byte_count = 0; byte_count < length; byte_count++)
+	{
+		psxpads_send_command(port, psx_status_commands[byte_count], samples[byte_count]);
+		if (byte_count == PSX_BYTE_ID) { length = psxpads_transfer_length(samples[PSX_BYTE_ID]); }
+		if (!psxpads_end_byte(port, byte_count == length - 1))
+		{
+			byte_count++;
+			break;
+		}
+	}
+	psxpads_deselect(port);
+	return byte_count;
+}
+
+static void psxpads_store_status(struct psx_pad pads[MAX_PADS], const uint8_t samples[PSX_MAX_TRANSFER_BYTES][8], int length)
+{
+	uint8_t data[PSX_MAX_TRANSFER_BYTES][MAX_PADS];
+	int byte_count, pad_count;
+
+	for (byte_count = 0; byte_count < length; byte_count++) { psxpads_decode_byte(samples[byte_count], data[byte_count]); }
+	memset(data[length], 0xFF, (PSX_MAX_TRANSFER_BYTES - length) * MAX_PADS);
+
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+	{
+		struct psx_pad* pad = &pads[pad_count];
+		int payload, axis_count;
+
+		pad->pad_id = data[PSX_BYTE_ID][pad_count];
+		pad->pad_status = data[PSX_BYTE_STATUS][pad_count];
+		payload = psxpad_payload_bytes(pad->pad_id);
+		pad->present = (payload != 0 && pad->pad_status == PSX_NORMAL_STATUS);
+		if (pad->present) { pad->button_status = data[PSX_BYTE_BUTTONS][pad_count] | (data[PSX_BYTE_BUTTONS + 1][pad_count] << 8); }
+		else { pad->button_status = PSX_BUTTONS_RELEASED; }
+		for (axis_count = 0; axis_count < MAX_AXES; axis_count++)
+		{
+			const bool has_axis = pad->present && PSX_BYTE_AXES + axis_count < PSX_BYTE_BUTTONS + payload;
+			pad->axes[axis_count] = has_axis ? data[PSX_BYTE_AXES + axis_count][pad_count] : PSX_AXIS_CENTRE;
+		}
+	}
+}
+
+/* uinput devices */
+
+static int uinput_create(void)
+{
+	struct uinput_user_dev dev;
+	int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	int count;
+
+	if (fd < 0) { perror("/dev/uinput"); return -1; }
+
+	memset(&dev, 0, sizeof(struct uinput_user_dev));
+	snprintf(dev.name, UINPUT_MAX_NAME_SIZE, "PSX Controller");
+	dev.id.bustype = BUS_PARPORT;
+	dev.id.vendor = 0x0001;
+	dev.id.product = PSX_PAD_ID;
+	dev.id.version = (uint16_t)LINTAP_VERSION;
+
+	ioctl(fd, UI_SET_EVBIT, EV_KEY);
+	ioctl(fd, UI_SET_EVBIT, EV_ABS);
+	for (count = 0; count < MAX_BUTTONS; count++) { ioctl(fd, UI_SET_KEYBIT, psxpad_button_events[count]); }
+	ioctl(fd, UI_SET_ABSBIT, ABS_X);
+	ioctl(fd, UI_SET_ABSBIT, ABS_Y);
+	dev.absmin[ABS_X] = dev.absmin[ABS_Y] = -255;
+	dev.absmax[ABS_X] = dev.absmax[ABS_Y] = 255;
+	for (count = 0; count < MAX_AXES; count++)
+	{
+		ioctl(fd, UI_SET_ABSBIT, psxpad_axis_events[count]);
+		dev.absmax[psxpad_axis_events[count]] = 255;
+		dev.absfuzz[psxpad_axis_events[count]] = PSX_AXIS_FUZZ;
+	}
+
+	if (write(fd, &dev, sizeof(struct uinput_user_dev)) != sizeof(struct uinput_user_dev) || ioctl(fd, UI_DEV_CREATE) != 0)
+	{
+		perror("uinput");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void uinput_destroy(int fd)
+{
+	ioctl(fd, UI_DEV_DESTROY);
+	close(fd);
+}
+
+static void lintapd_event(struct input_event* events, int* count, uint16_t type, uint16_t code, int32_t value)
+{
+	memset(&events[*count], 0, sizeof(struct input_event));
+	events[*count].type = type;
+	events[*count].code = code;
+	events[*count].value = value;
+	(*count)++;
+}
+
+// Report whatever changed since the last report in a single write, like psxpad_report
+static void psxpad_report(struct psx_pad* pad)
+{
+	struct input_event events[2 + MAX_BUTTONS + MAX_AXES + 1];
+	const uint16_t changed = pad->button_status ^ pad->reported_status;
+	int count = 0, button_count, axis_count;
+
+	if (changed & (PSX_LEFT | PSX_RIGHT))
+	{
+		lintapd_event(events, &count, EV_ABS, ABS_X, (pad->button_status & PSX_RIGHT ? 0 : 255) - (pad->button_status & PSX_LEFT ? 0 : 255));
+	}
+	if (changed & (PSX_UP | PSX_DOWN))
+	{
+		lintapd_event(events, &count, EV_ABS, ABS_Y, (pad->button_status & PSX_DOWN ? 0 : 255) - (pad->button_status & PSX_UP ? 0 : 255));
+	}
+	for (button_count = 0; button_count < MAX_BUTTONS; button_count++)
+	{
+		if (changed & psxpad_button_masks[button_count])
+		{
+			lintapd_event(events, &count, EV_KEY, psxpad_button_events[button_count], !(pad->button_status & psxpad_button_masks[button_count]));
+		}
+	}
+	for (axis_count = 0; axis_count < MAX_AXES; axis_count++)
+	{
+		if (pad->axes[axis_count] != pad->reported_axes[axis_count]) { lintapd_event(events, &count, EV_ABS, psxpad_axis_events[axis_count], pad->axes[axis_count]); }
+	}
+	if (count == 0) { return; }
+
+	lintapd_event(events, &count, EV_SYN, SYN_REPORT, 0);
+	if (write(pad->uinput_fd, events, count * sizeof(struct input_event)) < 0) { perror("uinput write"); }
+	pad->reported_status = pad->button_status;
+	memcpy(pad->reported_axes, pad->axes, MAX_AXES);
+}
+
+// Create devices for pads which have been connected, remove those of pads missing for too long
+// and report the rest.  If a device can't be created, none are tried again for a while, rather
+// than failing on every poll
+static void psxpads_publish(struct psx_pad pads[MAX_PADS], int missed_limit)
+{
+	int pad_count;
+
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+	{
+		struct psx_pad* pad = &pads[pad_count];
+
+		if (pad->present)
+		{
+			pad->missed_polls = 0;
+			if (pad->uinput_fd < 0 && lintapd_now() >= uinput_retry)
+			{
+				pad->uinput_fd = uinput_create();
+				if (pad->uinput_fd < 0)
+				{
+					fprintf(stderr, "Can't create a device for pad %d, trying again in %d seconds\n", pad_count, UINPUT_RETRY_SECONDS);
+					uinput_retry = lintapd_now() + UINPUT_RETRY_SECONDS * NSEC_PER_SEC;
+				}
+				pad->reported_status = PSX_BUTTONS_RELEASED;
+				memset(pad->reported_axes, PSX_AXIS_CENTRE, MAX_AXES);
+			}
+		}
+		else if (pad->uinput_fd >= 0 && ++pad->missed_polls >= missed_limit)
+		{
+			uinput_destroy(pad->uinput_fd);
+			pad->uinput_fd = -1;
+		}
+		if (pad->uinput_fd >= 0) { psxpad_report(pad); }
+	}
+}
+
+/* Poll loop */
+
+static void lintapd_timing_count(struct lintapd_timing* timing, uint64_t elapsed)
+{
+	if (timing->count == 0 || elapsed < timing->min_ns) { timing->min_ns = elapsed; }
+	if (elapsed > timing->max_ns) { timing->max_ns = elapsed; }
+	timing->total_ns += elapsed;
+	timing->count++;
+}
+
+static void lintapd_timing_print(const char* name, const struct lintapd_timing* timing)
+{
+	if (timing->count == 0) { return; }
+	printf("%-12s avg %8llu ns  min %8llu ns  max %8llu ns\n", name, (unsigned long long)(timing->total_ns / timing->count),
+		(unsigned long long)timing->min_ns, (unsigned long long)timing->max_ns);
+}
+
+static void lintapd_stop(int signal_number)
+{
+	(void)signal_number;
+	running = 0;
+}
+
+// Real time scheduling and locked memory, so page faults and other tasks don't delay polls.
+// Failing either is only a warning, the daemon still works without them
+static void lintapd_realtime(int priority, int cpu)
+{
+	if (cpu >= 0)
+	{
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) != 0) { perror("sched_setaffinity"); }
+	}
+	if (priority > 0)
+	{
+		struct sched_param param = { .sched_priority = priority };
+
+		if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) { perror("sched_setscheduler"); }
+	}
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) { perror("mlockall"); }
+}
+
+static void lintapd_usage(const char* name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d device     parport device to use (default /dev/parport0)\n"
+		"  -s            simulate the port instead of using a device\n"
+		"  -m mask       slots with a simulated pad in them (default 0x1)\n"
+		"  -i id         ID of the simulated pads (default 0x41)\n"
+		"  -t msecs      simulated pads press and release every button this often (default 0, never)\n"
+		"  -r hz         polls per second (default 100), 0 to poll back to back when benchmarking\n"
+		"  -b usecs      delay between clock edges (default 5)\n"
+		"  -c usecs      delay after each byte (default 10)\n"
+		"  -a            wait for the pads to acknowledge each byte instead of the byte delay\n"
+		"  -A usecs      acknowledge timeout (default 100)\n"
+		"  -p priority   SCHED_FIFO priority, 0 for normal scheduling (default 50)\n"
+		"  -C cpu        run on this CPU only\n"
+		"  -n polls      benchmark: poll this many times without creating input devices, then print timings\n",
+		name);
+}
+
+int main(int argc, char** argv)
+{
+	const char* device = "/dev/parport0";
+	bool simulate = false;
+	unsigned int sim_present = 0x1, sim_pad_id = 0x41, sim_toggle_ms = 0, rate = POLL_HZ;
+	int priority = POLL_PRIORITY, cpu = -1, option, pad_count;
+	unsigned long long bench_polls = 0, polls = 0;
+	struct lintapd_port port;
+	struct psx_pad pads[MAX_PADS];
+	struct lintapd_timing transfer = { 0 }, lateness = { 0 }, report = { 0 };
+	uint64_t next_poll, period, bench_start;
+	struct sigaction action;
+
+	while ((option = getopt(argc, argv, "d:sm:i:t:r:b:c:aA:p:C:n:h")) != -1)
+	{
+		switch (option)
+		{
+			case 'd': device = optarg; break;
+			case 's': simulate = true; break;
+			case 'm': sim_present = strtoul(optarg, NULL, 0); break;
+			case 'i': sim_pad_id = strtoul(optarg, NULL, 0); break;
+			case 't': sim_toggle_ms = strtoul(optarg, NULL, 0); break;
+			case 'r': rate = strtoul(optarg, NULL, 0); break;
+			case 'b': bit_delay = strtoul(optarg, NULL, 0); break;
+			case 'c': cmd_delay = strtoul(optarg, NULL, 0); break;
+			case 'a': ack_handshake = true; break;
+			case 'A': ack_timeout = strtoul(optarg, NULL, 0); break;
+			case 'p': priority = atoi(optarg); break;
+			case 'C': cpu = atoi(optarg); break;
+			case 'n': bench_polls = strtoull(optarg, NULL, 0); break;
+			default: lintapd_usage(argv[0]); return option == 'h' ? 0 : 1;
+		}
+	}
+	if (rate == 0 && bench_polls == 0) { fprintf(stderr, "A poll rate of 0 is only for benchmarking\n"); return 1; }
+
+	if (simulate) { lintapd_sim_open(&port, sim_present, (uint8_t)sim_pad_id, sim_toggle_ms); }
+	else if (!lintapd_ppdev_open(&port, device)) { return 1; }
+
+	memset(pads, 0, sizeof(pads));
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++) { pads[pad_count].uinput_fd = -1; }
+
+	memset(&action, 0, sizeof(struct sigaction));
+	action.sa_handler = lintapd_stop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	lintapd_realtime(priority, cpu);
+
+	period = rate == 0 ? 0 : NSEC_PER_SEC / rate;
+	next_poll = bench_start = lintapd_now();
+	while (running && (bench_polls == 0 || polls < bench_polls))
+	{
+		uint8_t samples[PSX_MAX_TRANSFER_BYTES][8];
+		const uint64_t start = lintapd_now();
+		uint64_t now;
+		int length;
+
+		lintapd_timing_count(&lateness, start - next_poll);
+		length = psxpads_capture(&port, samples);
+		now = lintapd_now();
+		lintapd_timing_count(&transfer, now - start);
+		psxpads_store_status(pads, samples, length);
+		if (bench_polls == 0) { psxpads_publish(pads, PAD_MISSED_SECONDS * rate); }
+		lintapd_timing_count(&report, lintapd_now() - now);
+		polls++;
+
+		// Deadlines are absolute so time spent polling doesn't stretch the period.  If the loop
+		// has fallen behind, start again from now rather than polling in a burst
+		next_poll += period;
+		now = lintapd_now();
+		if (next_poll <= now) { next_poll = now + period; }
+		if (period != 0)
+		{
+			struct timespec deadline = { .tv_sec = next_poll / NSEC_PER_SEC, .tv_nsec = next_poll % NSEC_PER_SEC };
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR && running) { }
+		}
+	}
+
+	if (bench_polls != 0)
+	{
+		const uint64_t elapsed = lintapd_now() - bench_start;
+
+		printf("%llu polls in %llu ms, %.1f polls per second, %s port\n", polls, (unsigned long long)(elapsed / 1000000),
+			elapsed == 0 ? 0.0 : polls * 1e9 / elapsed, simulate ? "simulated" : device);
+		lintapd_timing_print("transaction", &transfer);
+		lintapd_timing_print("decode", &report);
+		if (period != 0) { lintapd_timing_print("lateness", &lateness); }
+	}
+
+	for (pad_count = 0; pad_count < MAX_PADS; pad_count++)
+	{
+		if (pads[pad_count].uinput_fd >= 0) { uinput_destroy(pads[pad_count].uinput_fd); }
+	}
+	if (port.fd >= 0)
+	{
+		port.write_data(&port, PSX_CLOCK|PSX_SELECT_ALL);
+		ioctl(port.fd, PPRELEASE);
+		close(port.fd);
+	}
+	return 0;
+}